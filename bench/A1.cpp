@@ -0,0 +1,346 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define main a1_main
+#include "../src/A1.cpp"
+#undef main
+
+/*
+ * Allocation counters, reset in every benchmark process.
+ */
+atomic<uint64_t> ALLOCATIONS(0), ALLOCATED_BYTES(0);
+
+/*
+ * Counting replacement for the global allocation function. The default
+ * deallocation functions release memory with `free`.
+ */
+void *operator new(size_t size) {
+  ++ALLOCATIONS;
+  ALLOCATED_BYTES += size;
+
+  if (void *p = malloc(size ? size : 1))
+    return p;
+
+  throw bad_alloc();
+}
+
+/*
+ * The measurements of a single benchmark.
+ */
+struct Result {
+  double seconds;
+  uint64_t iterations, allocations, bytes;
+  long peak_rss;
+};
+
+/*
+ * A pair of synthetic input files.
+ */
+struct Corpus {
+  string label, file1, file2;
+  uint64_t size;
+};
+
+/*
+ * Parses a size such as `1K`, `1M` or `1G`.
+ *
+ * @param text The size text.
+ * @return The size in bytes.
+ */
+uint64_t parse_size(const string &text) {
+  uint64_t value = stoull(text);
+
+  switch (text.back()) {
+  case 'G':
+    return value << 30;
+  case 'M':
+    return value << 20;
+  case 'K':
+    return value << 10;
+  default:
+    return value;
+  }
+}
+
+/*
+ * Writes a pair of synthetic files.
+ *
+ * The first file holds lines of random words from a small vocabulary.
+ * The second is a copy in which every line is modified, deleted or
+ * preceded by a new line with probability `rate`.
+ *
+ * @param file1 The path of the original file.
+ * @param file2 The path of the edited file.
+ * @param size The approximate size of each file in bytes.
+ * @param rate The fraction of edited lines.
+ */
+void generate_corpus(
+  const string &file1, const string &file2, uint64_t size, double rate
+) {
+  static const vector<string> WORDS = {
+    "alpha", "beta",  "gamma", "delta", "epsilon", "zeta", "eta",
+    "theta", "iota",  "kappa", "lambda", "mu",     "nu",   "xi",
+    "pi",    "rho",   "sigma", "tau",   "upsilon", "phi",  "chi"};
+
+  mt19937_64 rng(size);
+
+  uniform_real_distribution<double> chance(0, 1);
+
+  auto make_line = [&]() {
+    string line = to_string(rng() % 100000);
+    for (int i = 0, n = 4 + rng() % 8; i < n; ++i)
+      line += ' ' + WORDS[rng() % WORDS.size()];
+    return line + '\n';
+  };
+
+  ofstream out1(file1, ios::binary), out2(file2, ios::binary);
+
+  for (uint64_t written = 0; written < size;) {
+    string line = make_line();
+
+    out1 << line;
+    written += line.size();
+
+    double roll = chance(rng);
+
+    if (roll < rate / 3)
+      out2 << make_line();
+    else if (roll < rate * 2 / 3)
+      continue;
+    else if (roll < rate)
+      out2 << make_line() << line;
+    else
+      out2 << line;
+  }
+}
+
+/*
+ * Checks that `list_mismatched_lines` prints the same hunks on one
+ * thread as on several.
+ *
+ * @param corpus The corpus to diff.
+ * @return Whether or not both outputs are byte-identical.
+ */
+bool same_line_diffs(const Corpus &corpus) {
+  stringstream serial, parallel;
+
+  streambuf *screen = cout.rdbuf(serial.rdbuf());
+  list_mismatched_lines(corpus.file1, corpus.file2);
+
+  cout.rdbuf(parallel.rdbuf());
+  list_mismatched_lines(corpus.file1, corpus.file2, 4);
+
+  cout.rdbuf(screen);
+
+  return serial.str() == parallel.str();
+}
+
+/*
+ * Runs a benchmark in a child process.
+ *
+ * The function is repeated until it has run for at least half a
+ * second. Running in a fresh process isolates the peak resident set
+ * size and the allocation counts of every benchmark.
+ *
+ * @param function The function to measure.
+ * @return The measurements.
+ */
+Result measure(const function<void()> &function) {
+  int fds[2];
+
+  if (pipe(fds) != 0)
+    return {};
+
+  fflush(stdout);
+
+  pid_t pid = fork();
+
+  if (pid == 0) {
+    close(fds[0]);
+    freopen("/dev/null", "w", stdout);
+
+    ALLOCATIONS = ALLOCATED_BYTES = 0;
+
+    Result result = {};
+
+    auto start = chrono::steady_clock::now();
+
+    do {
+      function();
+      ++result.iterations;
+      result.seconds = chrono::duration<double>(
+                         chrono::steady_clock::now() - start
+      )
+                         .count();
+    } while (result.seconds < 0.5);
+
+    cout.flush();
+
+    result.allocations = ALLOCATIONS;
+    result.bytes = ALLOCATED_BYTES;
+
+    if (write(fds[1], &result, sizeof(result)) != sizeof(result))
+      _exit(1);
+
+    _exit(0);
+  }
+
+  close(fds[1]);
+
+  Result result = {};
+
+  if (read(fds[0], &result, sizeof(result)) != sizeof(result))
+    result = {};
+
+  close(fds[0]);
+
+  int status;
+  struct rusage usage;
+
+  wait4(pid, &status, 0, &usage);
+
+#if defined(__APPLE__)
+  result.peak_rss = usage.ru_maxrss;
+#else
+  result.peak_rss = usage.ru_maxrss * 1024;
+#endif
+
+  return result;
+}
+
+/*
+ * Formats a quantity with a binary unit suffix.
+ *
+ * @param value The quantity.
+ * @param unit The unit appended after the suffix.
+ * @return The formatted quantity.
+ */
+string human(double value, const string &unit) {
+  const char *prefixes[] = {"", "K", "M", "G", "T"};
+
+  int i = 0;
+
+  while (value >= 1024 && i < 4)
+    value /= 1024, ++i;
+
+  char buffer[32];
+  snprintf(
+    buffer, sizeof(buffer), "%.1f %s%s", value, prefixes[i], unit.c_str()
+  );
+
+  return buffer;
+}
+
+/*
+ * Runs every A1 diff function over synthetic corpora and reports time
+ * per iteration, throughput, allocations and peak RSS.
+ *
+ * Usage: bench [SIZE...], where sizes default to 1K 1M 1G.
+ */
+int main(int argc, char **argv) {
+  vector<string> sizes(argv + 1, argv + argc);
+
+  if (sizes.empty())
+    sizes = {"1K", "1M", "1G"};
+
+  filesystem::path dir =
+    filesystem::temp_directory_path() / ("a1-bench-" + to_string(getpid()));
+
+  filesystem::create_directories(dir);
+
+  vector<Corpus> corpora;
+
+  for (const string &size : sizes) {
+    for (double rate : {0.0, 0.01}) {
+      string label = size + "/" + to_string(int(rate * 100)) + "%",
+             name = size + "-" + to_string(int(rate * 100));
+
+      Corpus corpus = {
+        label, (dir / (name + ".a")).string(), (dir / (name + ".b")).string(),
+        0};
+
+      generate_corpus(corpus.file1, corpus.file2, parse_size(size), rate);
+
+      corpus.size = filesystem::file_size(corpus.file1) +
+                    filesystem::file_size(corpus.file2);
+
+      if (!same_line_diffs(corpus)) {
+        fprintf(
+          stderr, "list_mismatched_lines/%s: parallel output differs\n",
+          label.c_str()
+        );
+        filesystem::remove_all(dir);
+        return 1;
+      }
+
+      corpora.push_back(corpus);
+    }
+  }
+
+  vector<pair<string, function<void(const Corpus &)>>> benchmarks = {
+    {"word_diff",
+     [](const Corpus &corpus) {
+       MappedFile map1(corpus.file1), map2(corpus.file2);
+       SpanReader reader1(map1), reader2(map2);
+       while (reader1.next() && reader2.next())
+         word_diff(string(reader1.word), string(reader2.word));
+     }},
+    {"classical_file_diff",
+     [](const Corpus &corpus) {
+       classical_file_diff(corpus.file1, corpus.file2);
+     }},
+    {"enhanced_file_diff",
+     [](const Corpus &corpus) {
+       enhanced_file_diff(corpus.file1, corpus.file2);
+     }},
+    {"list_mismatched_lines",
+     [](const Corpus &corpus) {
+       list_mismatched_lines(corpus.file1, corpus.file2);
+     }},
+    {"list_mismatched_lines/parallel",
+     [](const Corpus &corpus) {
+       list_mismatched_lines(
+         corpus.file1, corpus.file2, thread::hardware_concurrency()
+       );
+     }},
+    {"list_mismatched_words",
+     [](const Corpus &corpus) {
+       list_mismatched_words(corpus.file1, corpus.file2);
+     }}};
+
+  printf(
+    "%-42s %12s %10s %12s %10s %12s %10s\n", "Benchmark", "Time",
+    "Iterations", "Throughput", "Allocs", "Alloc bytes", "Peak RSS"
+  );
+
+  printf("%s\n", string(114, '-').c_str());
+
+  for (auto &[name, benchmark] : benchmarks) {
+    for (const Corpus &corpus : corpora) {
+      Result result = measure([&]() { benchmark(corpus); });
+
+      uint64_t iterations = max<uint64_t>(result.iterations, 1);
+
+      double per_iteration = result.seconds / iterations;
+
+      printf(
+        "%-42s %9.3f ms %10llu %12s %10llu %12s %10s\n",
+        (name + "/" + corpus.label).c_str(), per_iteration * 1000,
+        (unsigned long long)result.iterations,
+        human(corpus.size / per_iteration, "B/s").c_str(),
+        (unsigned long long)(result.allocations / iterations),
+        human(double(result.bytes) / iterations, "B").c_str(),
+        human(result.peak_rss, "B").c_str()
+      );
+
+      fflush(stdout);
+    }
+  }
+
+  filesystem::remove_all(dir);
+}
@@ -1,202 +1,1791 @@
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
 #include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
 #include <vector>
 
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 using namespace std;
 
 /*
- * Compare two strings.
+ * Compare two strings.
+ *
+ * Checks whether or not the two input strings have
+ * the same content.
+ *
+ * @param word1 The first input string.
+ * @param word2 The second input string.
+ * @return Whether or not the two strings are identical.
+ */
+bool word_diff(string word1, string word2) {
+  return word1 == word2;
+}
+
+/*
+ * A read-only memory mapping of a regular file.
+ */
+class MappedFile {
+  public:
+    const char *data;
+    size_t size;
+
+    MappedFile(const string &file) {
+      this->data = nullptr;
+      this->size = 0;
+      this->fd = open(file.c_str(), O_RDONLY);
+
+      struct stat info;
+
+      if (fd < 0 || fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        release();
+        return;
+      }
+
+      size = info.st_size;
+
+      if (size == 0)
+        return;
+
+      void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+      if (addr == MAP_FAILED) {
+        release();
+        return;
+      }
+
+      madvise(addr, size, MADV_SEQUENTIAL);
+
+      data = static_cast<const char *>(addr);
+    }
+
+    /*
+     * Whether or not the file could be mapped.
+     */
+    bool is_open() {
+      return fd >= 0;
+    }
+
+    ~MappedFile() {
+      release();
+    }
+
+  private:
+    int fd;
+
+    void release() {
+      if (data != nullptr)
+        munmap(const_cast<char *>(data), size);
+
+      if (fd >= 0)
+        close(fd);
+
+      data = nullptr;
+      size = 0;
+      fd = -1;
+    }
+};
+
+/*
+ * Checks whether or not a byte is whitespace, as seen by `>>`.
+ *
+ * @param c The input byte.
+ * @return Whether or not `c` is one of " \t\n\v\f\r".
+ */
+inline bool is_space(char c) {
+  return c == ' ' || static_cast<unsigned char>(c - '\t') <= '\r' - '\t';
+}
+
+#if defined(__SSE2__)
+/*
+ * Classifies 64 bytes at once with SSE2.
+ *
+ * @param p The bytes to classify.
+ * @param space Bit `i` is set when `p[i]` is whitespace (output).
+ * @param newline Bit `i` is set when `p[i]` is a newline (output).
+ */
+inline void classify_sse2(const char *p, uint64_t &space, uint64_t &newline) {
+  space = newline = 0;
+
+  for (int i = 0; i < 64; i += 16) {
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i)),
+            shifted = _mm_sub_epi8(bytes, _mm_set1_epi8('\t')),
+            control = _mm_cmpeq_epi8(
+              _mm_min_epu8(shifted, _mm_set1_epi8('\r' - '\t')), shifted
+            ),
+            blank = _mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')),
+            line = _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n'));
+
+    space |= uint64_t(_mm_movemask_epi8(_mm_or_si128(control, blank))) << i;
+    newline |= uint64_t(_mm_movemask_epi8(line)) << i;
+  }
+}
+#endif
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HAS_AVX2_DISPATCH
+
+/*
+ * Classifies 64 bytes at once with AVX2.
+ *
+ * @param p The bytes to classify.
+ * @param space Bit `i` is set when `p[i]` is whitespace (output).
+ * @param newline Bit `i` is set when `p[i]` is a newline (output).
+ */
+__attribute__((target("avx2"))) void
+classify_avx2(const char *p, uint64_t &space, uint64_t &newline) {
+  space = newline = 0;
+
+  for (int i = 0; i < 64; i += 32) {
+    __m256i bytes =
+              _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i)),
+            shifted = _mm256_sub_epi8(bytes, _mm256_set1_epi8('\t')),
+            control = _mm256_cmpeq_epi8(
+              _mm256_min_epu8(shifted, _mm256_set1_epi8('\r' - '\t')), shifted
+            ),
+            blank = _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' ')),
+            line = _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\n'));
+
+    space |= uint64_t(uint32_t(
+               _mm256_movemask_epi8(_mm256_or_si256(control, blank))
+             ))
+             << i;
+    newline |= uint64_t(uint32_t(_mm256_movemask_epi8(line))) << i;
+  }
+}
+#endif
+
+/*
+ * Classifies 64 bytes at once.
+ *
+ * Uses AVX2 when the CPU supports it, SSE2 otherwise, and plain byte
+ * checks on other architectures.
+ *
+ * @param p The bytes to classify.
+ * @param space Bit `i` is set when `p[i]` is whitespace (output).
+ * @param newline Bit `i` is set when `p[i]` is a newline (output).
+ */
+void classify_block(const char *p, uint64_t &space, uint64_t &newline) {
+#if defined(HAS_AVX2_DISPATCH)
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+
+  if (avx2)
+    return classify_avx2(p, space, newline);
+#endif
+
+#if defined(__SSE2__)
+  classify_sse2(p, space, newline);
+#else
+  space = newline = 0;
+
+  for (int i = 0; i < 64; ++i) {
+    space |= uint64_t(is_space(p[i])) << i;
+    newline |= uint64_t(p[i] == '\n') << i;
+  }
+#endif
+}
+
+/*
+ * The location of a word inside a buffer.
+ *
+ * Lines and columns start at 1, columns count bytes.
+ */
+struct Span {
+  uint64_t offset;
+  uint32_t length, line, column;
+};
+
+/*
+ * Splits a buffer into whitespace separated words.
+ *
+ * The buffer is classified 64 bytes at a time into whitespace and
+ * newline bitmasks, from which word boundaries and line numbers are
+ * read off with bit scans. Words come out one at a time as spans, so
+ * nothing is copied.
+ */
+class Tokenizer {
+  public:
+    Tokenizer(const char *data, size_t size) {
+      this->data = data;
+      this->size = size;
+      this->block = 0;
+      this->next_block = 0;
+      this->starts = 0;
+      this->ends = 0;
+      this->newlines = 0;
+      this->carry = 1;
+      this->line = 1;
+      this->line_start = 0;
+    }
+
+    /*
+     * Advance to the next word.
+     *
+     * @param span The location of the word (output).
+     * @return Whether or not a word was found.
+     */
+    bool next(Span &span) {
+      for (;;) {
+        uint64_t events = starts | ends;
+
+        if (events == 0) {
+          if (!advance())
+            return false;
+          continue;
+        }
+
+        uint64_t bit = events & -events, offset = block + __builtin_ctzll(bit);
+
+        if (starts & bit) {
+          starts ^= bit;
+          count_newlines(newlines & (bit - 1));
+          word = {offset, 0, line, uint32_t(offset - line_start + 1)};
+        } else {
+          ends ^= bit;
+          span = word;
+          span.length = offset - word.offset;
+          return true;
+        }
+      }
+    }
+
+  private:
+    const char *data;
+    size_t size, block, next_block;
+    uint64_t starts, ends, newlines, carry, line_start;
+    uint32_t line;
+    Span word;
+
+    void count_newlines(uint64_t mask) {
+      if (mask == 0)
+        return;
+
+      line += __builtin_popcountll(mask);
+      line_start = block + 64 - __builtin_clzll(mask);
+      newlines ^= mask;
+    }
+
+    /*
+     * Classify the next block, padding the end of the buffer with spaces.
+     *
+     * @return Whether or not there was a block left.
+     */
+    bool advance() {
+      count_newlines(newlines);
+
+      if (next_block > size)
+        return false;
+
+      block = next_block;
+      next_block += 64;
+
+      uint64_t space, newline;
+
+      if (size - block >= 64) {
+        classify_block(data + block, space, newline);
+      } else {
+        char padded[64];
+        memset(padded, ' ', sizeof(padded));
+        memcpy(padded, data + block, size - block);
+        classify_block(padded, space, newline);
+      }
+
+      uint64_t shifted = (space << 1) | carry;
+
+      starts = ~space & shifted;
+      ends = space & ~shifted;
+      newlines = newline;
+      carry = space >> 63;
+
+      return true;
+    }
+};
+
+/*
+ * Diffs two mapped files by individual word comparison.
+ *
+ * Words are compared in place inside the mappings, stopping at the
+ * first difference.
+ *
+ * @param file1 The first mapped file.
+ * @param file2 The second mapped file.
+ * @return Whether or not the two input files are identical in content.
+ */
+bool mapped_file_diff(MappedFile &file1, MappedFile &file2) {
+  Tokenizer tokens1(file1.data, file1.size), tokens2(file2.data, file2.size);
+
+  Span span1, span2;
+
+  while (tokens1.next(span1) && tokens2.next(span2)) {
+    if (span1.length != span2.length ||
+        memcmp(
+          file1.data + span1.offset, file2.data + span2.offset, span1.length
+        ) != 0)
+      return false;
+  }
+
+  return true;
+}
+
+/*
+ * Diffs two files by individual word comparison.
+ *
+ * Checks whether or not the two files contain the
+ * same content. Regular files are compared through
+ * memory mappings, anything else (pipes, devices) is
+ * read word by word through streams.
+ *
+ * @param file1 The first input file relative path.
+ * @param file2 The second input file relative path.
+ * @return Whether or not the two input files are identical in content.
+ */
+bool classical_file_diff(string file1, string file2) {
+  MappedFile map1(file1), map2(file2);
+
+  if (map1.is_open() && map2.is_open())
+    return mapped_file_diff(map1, map2);
+
+  ifstream file1_stream(file1), file2_stream(file2);
+
+  string lhs, rhs;
+
+  auto close = [&]() {
+    file1_stream.close();
+    file2_stream.close();
+  };
+
+  while (file1_stream >> lhs && file2_stream >> rhs) {
+    if (!word_diff(lhs, rhs)) {
+      close();
+      return false;
+    }
+  }
+
+  close();
+
+  return true;
+}
+
+/*
+ * Computes a hash value for a given input
+ * string.
+ *
+ * @param someString The input string.
+ * @return The computed hash value.
+ */
+size_t hash_it(string_view someString) {
+  return hash<string_view>{}(someString);
+}
+
+/*
+ * A 128-bit hash value.
+ */
+struct Hash128 {
+  uint64_t low, high;
+
+  bool operator==(const Hash128 &other) const {
+    return low == other.low && high == other.high;
+  }
+
+  bool operator!=(const Hash128 &other) const {
+    return !(*this == other);
+  }
+};
+
+/*
+ * An incremental 128-bit MurmurHash3 (x64 variant).
+ *
+ * Data can be fed in pieces of any size, the digest only depends on
+ * the concatenated bytes.
+ */
+class StreamHasher {
+  public:
+    StreamHasher() {
+      this->h1 = 0;
+      this->h2 = 0;
+      this->length = 0;
+      this->pending = 0;
+    }
+
+    /*
+     * Feed more bytes into the hash.
+     *
+     * @param data The bytes to hash.
+     * @param size The number of bytes.
+     */
+    void update(const char *data, size_t size) {
+      length += size;
+
+      if (pending > 0) {
+        size_t take = min(size, sizeof(tail) - pending);
+
+        memcpy(tail + pending, data, take);
+        pending += take;
+        data += take, size -= take;
+
+        if (pending < sizeof(tail))
+          return;
+
+        mix(tail);
+        pending = 0;
+      }
+
+      for (; size >= 16; data += 16, size -= 16)
+        mix(data);
+
+      memcpy(tail, data, size);
+      pending = size;
+    }
+
+    /*
+     * Finish the hash.
+     *
+     * @return The hash of every byte fed so far.
+     */
+    Hash128 digest() const {
+      uint64_t a = h1, b = h2, k1 = 0, k2 = 0;
+
+      for (size_t i = pending; i > 8; --i)
+        k2 = (k2 << 8) | static_cast<unsigned char>(tail[i - 1]);
+
+      for (size_t i = min<size_t>(pending, 8); i > 0; --i)
+        k1 = (k1 << 8) | static_cast<unsigned char>(tail[i - 1]);
+
+      if (pending > 8)
+        b ^= rotl(k2 * C2, 33) * C1;
+
+      if (pending > 0)
+        a ^= rotl(k1 * C1, 31) * C2;
+
+      a ^= length, b ^= length;
+      a += b, b += a;
+      a = fmix(a), b = fmix(b);
+      a += b, b += a;
+
+      return {a, b};
+    }
+
+  private:
+    static constexpr uint64_t C1 = 0x87c37b91114253d5ULL;
+    static constexpr uint64_t C2 = 0x4cf5ad432745937fULL;
+
+    uint64_t h1, h2, length;
+    char tail[16];
+    size_t pending;
+
+    static uint64_t rotl(uint64_t x, int r) {
+      return (x << r) | (x >> (64 - r));
+    }
+
+    static uint64_t fmix(uint64_t k) {
+      k ^= k >> 33;
+      k *= 0xff51afd7ed558ccdULL;
+      k ^= k >> 33;
+      k *= 0xc4ceb9fe1a85ec53ULL;
+      k ^= k >> 33;
+      return k;
+    }
+
+    void mix(const char *block) {
+      uint64_t k1, k2;
+
+      memcpy(&k1, block, 8);
+      memcpy(&k2, block + 8, 8);
+
+      h1 ^= rotl(k1 * C1, 31) * C2;
+      h1 = (rotl(h1, 27) + h2) * 5 + 0x52dce729;
+
+      h2 ^= rotl(k2 * C2, 33) * C1;
+      h2 = (rotl(h2, 31) + h1) * 5 + 0x38495ab5;
+    }
+};
+
+/*
+ * The size of the blocks files are read in.
+ */
+const size_t BLOCK_SIZE = 1 << 16;
+
+/*
+ * Get the modification time of a file in nanoseconds.
+ *
+ * @param info The status of the file.
+ * @return The modification time since the epoch.
+ */
+uint64_t mtime_ns(const struct stat &info) {
+#if defined(__APPLE__)
+  const struct timespec &mtime = info.st_mtimespec;
+#else
+  const struct timespec &mtime = info.st_mtim;
+#endif
+
+  return uint64_t(mtime.tv_sec) * 1000000000ULL + mtime.tv_nsec;
+}
+
+/*
+ * A persistent cache of file content hashes.
+ *
+ * Entries are keyed by the device, inode, size and modification time
+ * of a file and live in a fixed-size open addressing table inside a
+ * shared memory mapping, so they survive restarts. Processes sharing a
+ * cache file serialize on `flock`, threads on a mutex.
+ */
+class HashCache {
+  public:
+    HashCache(const string &path, uint64_t capacity = 1 << 16) {
+      this->entries = nullptr;
+      this->capacity = 0;
+      this->fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+
+      if (fd < 0)
+        return;
+
+      flock(fd, LOCK_EX);
+
+      struct stat info;
+
+      Header header = {{'A', '1', 'H', 'A', 'S', 'H', '\0', '\1'}, capacity};
+
+      if (fstat(fd, &info) == 0 && info.st_size == 0) {
+        if (ftruncate(fd, sizeof(Header) + capacity * sizeof(Entry)) != 0 ||
+            pwrite(fd, &header, sizeof(header), 0) != sizeof(header))
+          header.capacity = 0;
+      } else if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+                 memcmp(header.magic, "A1HASH\0\1", 8) != 0 ||
+                 fstat(fd, &info) != 0 ||
+                 uint64_t(info.st_size) !=
+                   sizeof(Header) + header.capacity * sizeof(Entry)) {
+        header.capacity = 0;
+      }
+
+      size_t length = sizeof(Header) + header.capacity * sizeof(Entry);
+
+      void *addr = header.capacity == 0
+                     ? MAP_FAILED
+                     : mmap(
+                         nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED,
+                         fd, 0
+                       );
+
+      flock(fd, LOCK_UN);
+
+      if (addr == MAP_FAILED) {
+        close(fd);
+        fd = -1;
+        return;
+      }
+
+      this->entries = reinterpret_cast<Entry *>(
+        static_cast<char *>(addr) + sizeof(Header)
+      );
+      this->capacity = header.capacity;
+    }
+
+    /*
+     * Whether or not the cache file could be opened.
+     */
+    bool is_open() {
+      return entries != nullptr;
+    }
+
+    /*
+     * Look up the hash of a file.
+     *
+     * @param info The current status of the file.
+     * @param hash The cached hash (output).
+     * @return Whether or not the file was found.
+     */
+    bool lookup(const struct stat &info, Hash128 &hash) {
+      Entry key = make_key(info);
+
+      lock_guard<mutex> guard(lock);
+
+      flock(fd, LOCK_SH);
+
+      bool found = false;
+
+      for (uint64_t i = 0; i < PROBES && !found; ++i) {
+        const Entry &entry = entries[(home(key) + i) % capacity];
+
+        if (same_key(entry, key)) {
+          hash = entry.hash;
+          found = true;
+        }
+      }
+
+      flock(fd, LOCK_UN);
+
+      return found;
+    }
+
+    /*
+     * Remember the hash of a file.
+     *
+     * Files modified within the last second are skipped, since another
+     * write in the same timestamp tick would go unnoticed.
+     *
+     * @param info The status of the file when it was hashed.
+     * @param hash The hash of the file's contents.
+     */
+    void store(const struct stat &info, Hash128 hash) {
+      Entry key = make_key(info);
+
+      if (key.mtime + 1000000000ULL > now())
+        return;
+
+      key.hash = hash;
+
+      lock_guard<mutex> guard(lock);
+
+      flock(fd, LOCK_EX);
+
+      Entry *slot = &entries[home(key)];
+
+      for (uint64_t i = 0; i < PROBES; ++i) {
+        Entry &entry = entries[(home(key) + i) % capacity];
+
+        if (same_key(entry, key) || entry.ino == 0) {
+          slot = &entry;
+          break;
+        }
+      }
+
+      *slot = key;
+
+      flock(fd, LOCK_UN);
+    }
+
+    ~HashCache() {
+      if (entries != nullptr)
+        munmap(
+          reinterpret_cast<char *>(entries) - sizeof(Header),
+          sizeof(Header) + capacity * sizeof(Entry)
+        );
+
+      if (fd >= 0)
+        close(fd);
+    }
+
+  private:
+    struct Header {
+      char magic[8];
+      uint64_t capacity;
+    };
+
+    struct Entry {
+      uint64_t dev, ino, size, mtime;
+      Hash128 hash;
+    };
+
+    static const uint64_t PROBES = 8;
+
+    int fd;
+    Entry *entries;
+    uint64_t capacity;
+    mutex lock;
+
+    static uint64_t now() {
+      return chrono::duration_cast<chrono::nanoseconds>(
+               chrono::system_clock::now().time_since_epoch()
+      )
+        .count();
+    }
+
+    static Entry make_key(const struct stat &info) {
+      return {
+        uint64_t(info.st_dev), uint64_t(info.st_ino), uint64_t(info.st_size),
+        mtime_ns(info), {0, 0}};
+    }
+
+    static bool same_key(const Entry &a, const Entry &b) {
+      return a.dev == b.dev && a.ino == b.ino && a.size == b.size &&
+             a.mtime == b.mtime;
+    }
+
+    uint64_t home(const Entry &key) {
+      uint64_t h = key.ino * 0x9e3779b97f4a7c15ULL;
+      h ^= (key.dev + key.size) * 0xc2b2ae3d27d4eb4fULL;
+      h ^= key.mtime * 0x165667b19e3779f9ULL;
+      return (h ^ (h >> 29)) % capacity;
+    }
+};
+
+/*
+ * Get the hash cache used for whole-file hashes.
+ *
+ * Caching is opt-in: it is enabled by pointing the `A1_HASH_CACHE`
+ * environment variable at a cache file, which is created on first use.
+ *
+ * @return The cache, or `nullptr` when caching is disabled.
+ */
+HashCache *hash_cache() {
+  static HashCache *cache = []() -> HashCache * {
+    const char *path = getenv("A1_HASH_CACHE");
+
+    if (path == nullptr)
+      return nullptr;
+
+    HashCache *cache = new HashCache(path);
+
+    return cache->is_open() ? cache : nullptr;
+  }();
+
+  return cache;
+}
+
+/*
+ * Hashes an open file one block at a time.
+ *
+ * @param fd The file descriptor, positioned at the first byte to hash.
+ * @param limit The maximum number of bytes to hash.
+ * @return The 128-bit hash of the bytes read.
+ */
+Hash128 hash_fd(int fd, uint64_t limit) {
+  StreamHasher hasher;
+
+  vector<char> buffer(min<uint64_t>(BLOCK_SIZE, limit));
+
+  while (limit > 0) {
+    ssize_t count =
+      read(fd, buffer.data(), min<uint64_t>(buffer.size(), limit));
+
+    if (count <= 0)
+      break;
+
+    hasher.update(buffer.data(), count);
+    limit -= count;
+  }
+
+  return hasher.digest();
+}
+
+/*
+ * Hashes a file one block at a time.
+ *
+ * Whole-file hashes go through the hash cache when it is enabled.
+ *
+ * @param file The file path.
+ * @param hash The 128-bit hash of the file's contents (output).
+ * @param limit The maximum number of leading bytes to hash.
+ * @return Whether or not the file could be opened.
+ */
+bool hash_file(
+  const string &file, Hash128 &hash, uint64_t limit = UINT64_MAX
+) {
+  int fd = open(file.c_str(), O_RDONLY);
+
+  if (fd < 0)
+    return false;
+
+  HashCache *cache = limit == UINT64_MAX ? hash_cache() : nullptr;
+
+  struct stat before, after;
+
+  bool cacheable =
+    cache != nullptr && fstat(fd, &before) == 0 && S_ISREG(before.st_mode);
+
+  if (cacheable && cache->lookup(before, hash)) {
+    close(fd);
+    return true;
+  }
+
+  hash = hash_fd(fd, limit);
+
+  if (cacheable && fstat(fd, &after) == 0 &&
+      before.st_size == after.st_size && mtime_ns(before) == mtime_ns(after))
+    cache->store(before, hash);
+
+  close(fd);
+
+  return true;
+}
+
+/*
+ * Hashes a file one block at a time.
+ *
+ * A file that cannot be read hashes like an empty one.
+ *
+ * @param file The file path.
+ * @param limit The maximum number of leading bytes to hash.
+ * @return The 128-bit hash of the file's contents.
+ */
+Hash128 hash_file(const string &file, uint64_t limit = UINT64_MAX) {
+  Hash128 hash;
+
+  if (!hash_file(file, hash, limit))
+    return StreamHasher().digest();
+
+  return hash;
+}
+
+/*
+ * Compares two files byte by byte, one block at a time.
+ *
+ * @param file1 The first input file relative path.
+ * @param file2 The second input file relative path.
+ * @return Whether or not both files hold exactly the same bytes.
+ */
+bool same_bytes(const string &file1, const string &file2) {
+  ifstream file1_stream(file1, ios::binary), file2_stream(file2, ios::binary);
+
+  vector<char> buffer1(BLOCK_SIZE), buffer2(BLOCK_SIZE);
+
+  for (;;) {
+    file1_stream.read(buffer1.data(), BLOCK_SIZE);
+    file2_stream.read(buffer2.data(), BLOCK_SIZE);
+
+    streamsize count1 = file1_stream.gcount(), count2 = file2_stream.gcount();
+
+    if (count1 != count2 || memcmp(buffer1.data(), buffer2.data(), count1))
+      return false;
+
+    if (count1 == 0)
+      return true;
+  }
+}
+
+/*
+ * Diffs two files by hashing.
+ *
+ * Determines whether or not the input files contain
+ * the same content by comparing the hashes of their
+ * respective file contents.
+ *
+ * Files of different sizes are reported as different
+ * without being read. Otherwise both files are hashed
+ * in fixed-size blocks, and a hash match can be
+ * confirmed byte by byte.
+ *
+ * @param file1 The first input file relative path.
+ * @param file2 The second input file relative path.
+ * @param verify Whether or not to confirm matching hashes byte by byte.
+ * @return Whether or not the input files' contents hash to the same value.
+ */
+bool enhanced_file_diff(string file1, string file2, bool verify = false) {
+  struct stat info1, info2;
+
+  if (stat(file1.c_str(), &info1) == 0 && stat(file2.c_str(), &info2) == 0 &&
+      S_ISREG(info1.st_mode) && S_ISREG(info2.st_mode) &&
+      info1.st_size != info2.st_size)
+    return false;
+
+  if (hash_file(file1) != hash_file(file2))
+    return false;
+
+  return !verify || same_bytes(file1, file2);
+}
+
+/*
+ * A work-stealing pool of worker threads.
+ *
+ * Every worker owns a queue of tasks. A worker runs its own tasks
+ * newest first and, once its queue is empty, steals the oldest task
+ * of another worker. Tasks submitted from inside a task go to the
+ * submitting worker's own queue.
+ */
+class ThreadPool {
+  public:
+    ThreadPool(size_t threads = thread::hardware_concurrency()) {
+      this->pending = 0;
+      this->queued = 0;
+      this->next = 0;
+      this->stopping = false;
+
+      threads = max<size_t>(threads, 1);
+
+      for (size_t i = 0; i < threads; ++i)
+        queues.push_back(make_unique<Queue>());
+
+      for (size_t i = 0; i < threads; ++i)
+        workers.emplace_back([this, i]() { run(i); });
+    }
+
+    /*
+     * Get the number of worker threads.
+     */
+    size_t size() {
+      return workers.size();
+    }
+
+    /*
+     * Schedule a task on the pool.
+     *
+     * @param task The task to run.
+     */
+    void submit(function<void()> task) {
+      size_t id = owner == this ? current : next++ % queues.size();
+
+      {
+        lock_guard<mutex> guard(lock);
+        ++pending;
+        ++queued;
+        lock_guard<mutex> queue_guard(queues[id]->lock);
+        queues[id]->tasks.push_back(move(task));
+      }
+
+      wake.notify_one();
+    }
+
+    /*
+     * Block until every submitted task has finished.
+     */
+    void wait() {
+      unique_lock<mutex> guard(lock);
+      idle.wait(guard, [this]() { return pending == 0; });
+    }
+
+    ~ThreadPool() {
+      {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+      }
+
+      wake.notify_all();
+
+      for (thread &worker : workers)
+        worker.join();
+    }
+
+  private:
+    struct Queue {
+      mutex lock;
+      deque<function<void()>> tasks;
+    };
+
+    static thread_local ThreadPool *owner;
+    static thread_local size_t current;
+
+    vector<unique_ptr<Queue>> queues;
+    vector<thread> workers;
+    mutex lock;
+    condition_variable wake, idle;
+    size_t pending, queued, next;
+    bool stopping;
+
+    /*
+     * Take a task from our own queue, or steal one from another worker.
+     */
+    bool take(size_t id, function<void()> &task) {
+      for (size_t i = 0; i < queues.size(); ++i) {
+        Queue &queue = *queues[(id + i) % queues.size()];
+
+        lock_guard<mutex> guard(queue.lock);
+
+        if (queue.tasks.empty())
+          continue;
+
+        if (i == 0) {
+          task = move(queue.tasks.back());
+          queue.tasks.pop_back();
+        } else {
+          task = move(queue.tasks.front());
+          queue.tasks.pop_front();
+        }
+
+        return true;
+      }
+
+      return false;
+    }
+
+    /*
+     * The worker loop.
+     */
+    void run(size_t id) {
+      owner = this;
+      current = id;
+
+      for (;;) {
+        {
+          unique_lock<mutex> guard(lock);
+          wake.wait(guard, [this]() { return stopping || queued > 0; });
+          if (queued == 0)
+            return;
+        }
+
+        function<void()> task;
+
+        if (!take(id, task))
+          continue;
+
+        {
+          lock_guard<mutex> guard(lock);
+          --queued;
+        }
+
+        task();
+
+        lock_guard<mutex> guard(lock);
+
+        if (--pending == 0)
+          idle.notify_all();
+      }
+    }
+};
+
+thread_local ThreadPool *ThreadPool::owner = nullptr;
+thread_local size_t ThreadPool::current = 0;
+
+/*
+ * A single operation in a line edit script.
+ */
+enum class Edit { Keep, Delete, Insert };
+
+/*
+ * Maps every distinct line of both inputs to a small integer ID.
+ *
+ * Each line is hashed once with `hash_it`, after which the diff engine
+ * only ever compares integers.
+ *
+ * @param lines1 The lines of the first input.
+ * @param lines2 The lines of the second input.
+ * @param ids1 The IDs of the first input's lines (output).
+ * @param ids2 The IDs of the second input's lines (output).
+ */
+void intern_lines(
+  const vector<string_view> &lines1, const vector<string_view> &lines2,
+  vector<int> &ids1, vector<int> &ids2
+) {
+  struct LineHash {
+    size_t operator()(string_view line) const {
+      return hash_it(line);
+    }
+  };
+
+  unordered_map<string_view, int, LineHash> table;
+
+  table.reserve(lines1.size() + lines2.size());
+
+  auto intern = [&](const vector<string_view> &lines, vector<int> &ids) {
+    ids.reserve(lines.size());
+    for (string_view line : lines)
+      ids.push_back(table.emplace(line, table.size()).first->second);
+  };
+
+  intern(lines1, ids1);
+  intern(lines2, ids2);
+}
+
+/*
+ * The classic greedy O(ND) Myers diff.
+ *
+ * Keeps one snapshot of the furthest reaching paths per edit distance
+ * and backtracks through them, so its memory is O(D * (N + M)). Only
+ * used by `myers_diff` for small subproblems.
+ *
+ * @param a The first ID sequence.
+ * @param n The length of `a`.
+ * @param b The second ID sequence.
+ * @param m The length of `b`.
+ * @param script The edit script to append to.
+ */
+void myers_diff_greedy(
+  const int *a, int n, const int *b, int m, vector<Edit> &script
+) {
+  int max = n + m;
+
+  vector<int> v(2 * max + 2, 0);
+  vector<vector<int>> trace;
+
+  for (int d = 0; d <= max; ++d) {
+    trace.push_back(v);
+
+    bool done = false;
+
+    for (int k = -d; k <= d && !done; k += 2) {
+      int x = (k == -d || (k != d && v[max + k - 1] < v[max + k + 1]))
+                ? v[max + k + 1]
+                : v[max + k - 1] + 1;
+      int y = x - k;
+
+      while (x < n && y < m && a[x] == b[y])
+        ++x, ++y;
+
+      v[max + k] = x;
+      done = x >= n && y >= m;
+    }
+
+    if (done)
+      break;
+  }
+
+  vector<Edit> reversed;
+
+  int x = n, y = m;
+
+  for (int d = trace.size() - 1; d >= 0; --d) {
+    const vector<int> &w = trace[d];
+
+    int k = x - y;
+
+    int prev_k = (k == -d || (k != d && w[max + k - 1] < w[max + k + 1]))
+                   ? k + 1
+                   : k - 1;
+
+    int prev_x = w[max + prev_k], prev_y = prev_x - prev_k;
+
+    while (x > prev_x && y > prev_y) {
+      reversed.push_back(Edit::Keep);
+      --x, --y;
+    }
+
+    if (d > 0)
+      reversed.push_back(x == prev_x ? Edit::Insert : Edit::Delete);
+
+    x = prev_x, y = prev_y;
+  }
+
+  script.insert(script.end(), reversed.rbegin(), reversed.rend());
+}
+
+/*
+ * The edit distance after which `middle_snake` gives up on an optimal
+ * split.
+ */
+const int MYERS_COST_LIMIT = 4096;
+
+/*
+ * Finds the middle snake of an optimal edit path.
+ *
+ * Runs the Myers search forwards from the top left and backwards from
+ * the bottom right at the same time until the two frontiers overlap.
+ * Past `MYERS_COST_LIMIT` edits the search stops, and the point that
+ * got furthest is used as an empty snake instead, so heavily rewritten
+ * inputs get a valid but possibly longer script in bounded time. The
+ * inputs must differ in their first and last elements.
+ *
+ * @param a The first ID sequence.
+ * @param n The length of `a`.
+ * @param b The second ID sequence.
+ * @param m The length of `b`.
+ * @param x0 The snake's start in `a` (output).
+ * @param y0 The snake's start in `b` (output).
+ * @param x1 The snake's end in `a` (output).
+ * @param y1 The snake's end in `b` (output).
+ */
+void middle_snake(
+  const int *a, int n, const int *b, int m, int &x0, int &y0, int &x1,
+  int &y1
+) {
+  int max = (n + m + 1) / 2, delta = n - m, limit = min(max, MYERS_COST_LIMIT);
+
+  bool odd = delta & 1;
+
+  vector<int> forward(2 * max + 3, 0), backward(2 * max + 3, 0);
+
+  auto fw = [&](int k) -> int & { return forward[max + 1 + k]; };
+  auto bw = [&](int k) -> int & { return backward[max + 1 + k]; };
+
+  for (int d = 0; d <= limit; ++d) {
+    for (int k = -d; k <= d; k += 2) {
+      int x = (k == -d || (k != d && fw(k - 1) < fw(k + 1))) ? fw(k + 1)
+                                                             : fw(k - 1) + 1;
+      int y = x - k, sx = x, sy = y;
+
+      while (x < n && y < m && a[x] == b[y])
+        ++x, ++y;
+
+      fw(k) = x;
+
+      int c = delta - k;
+
+      if (odd && c >= -(d - 1) && c <= d - 1 && x + bw(c) >= n) {
+        x0 = sx, y0 = sy, x1 = x, y1 = y;
+        return;
+      }
+    }
+
+    for (int c = -d; c <= d; c += 2) {
+      int x = (c == -d || (c != d && bw(c - 1) < bw(c + 1))) ? bw(c + 1)
+                                                             : bw(c - 1) + 1;
+      int y = x - c, sx = x, sy = y;
+
+      while (x < n && y < m && a[n - 1 - x] == b[m - 1 - y])
+        ++x, ++y;
+
+      bw(c) = x;
+
+      int k = delta - c;
+
+      if (!odd && k >= -d && k <= d && x + fw(k) >= n) {
+        x0 = n - x, y0 = m - y, x1 = n - sx, y1 = m - sy;
+        return;
+      }
+    }
+  }
+
+  int best = -1;
+
+  for (int k = -limit; k <= limit; k += 2) {
+    int x = fw(k), y = x - k;
+
+    if (x <= n && y >= 0 && y <= m && x + y > best)
+      best = x + y, x0 = x1 = x, y0 = y1 = y;
+
+    x = bw(k), y = x - k;
+
+    if (x <= n && y >= 0 && y <= m && x + y > best)
+      best = x + y, x0 = x1 = n - x, y0 = y1 = m - y;
+  }
+}
+
+/*
+ * Measures the common prefix and suffix of two ID sequences.
  *
- * Checks whether or not the two input strings have
- * the same content.
+ * The suffix is only looked for after the prefix, so the two never
+ * overlap.
  *
- * @param word1 The first input string.
- * @param word2 The second input string.
- * @return Whether or not the two strings are identical.
+ * @param a The first ID sequence.
+ * @param n The length of `a`.
+ * @param b The second ID sequence.
+ * @param m The length of `b`.
+ * @param prefix The length of the common prefix (output).
+ * @param suffix The length of the common suffix (output).
  */
-bool word_diff(string word1, string word2) {
-  return word1 == word2;
+void common_ends(
+  const int *a, int n, const int *b, int m, int &prefix, int &suffix
+) {
+  prefix = 0;
+
+  while (prefix < n && prefix < m && a[prefix] == b[prefix])
+    ++prefix;
+
+  suffix = 0;
+
+  while (suffix < n - prefix && suffix < m - prefix &&
+         a[n - 1 - suffix] == b[m - 1 - suffix])
+    ++suffix;
 }
 
 /*
- * Diffs two files by individual word comparison.
+ * Computes an edit script between two ID sequences.
  *
- * Checks whether or not the two files contain the
- * same content.
+ * This is the linear space variant of the Myers algorithm: it splits
+ * the problem around the middle snake and recurses on both halves, so
+ * memory stays O(N + M) while time stays O(ND). Small subproblems are
+ * handed to `myers_diff_greedy`. The script is minimal as long as no
+ * middle snake search runs past `MYERS_COST_LIMIT` edits, otherwise
+ * it is only valid.
  *
- * @param file1 The first input file relative path.
- * @param file2 The second input file relative path.
- * @return Whether or not the two input files are identical in content.
+ * @param a The first ID sequence.
+ * @param n The length of `a`.
+ * @param b The second ID sequence.
+ * @param m The length of `b`.
+ * @param script The edit script to append to.
  */
-bool classical_file_diff(string file1, string file2) {
-  ifstream file1_stream(file1), file2_stream(file2);
+void myers_diff(
+  const int *a, int n, const int *b, int m, vector<Edit> &script
+) {
+  int prefix, suffix;
 
-  string lhs, rhs;
+  common_ends(a, n, b, m, prefix, suffix);
 
-  auto close = [&]() {
-    file1_stream.close();
-    file2_stream.close();
-  };
+  script.insert(script.end(), prefix, Edit::Keep);
 
-  while (file1_stream >> lhs && file2_stream >> rhs) {
-    if (!word_diff(lhs, rhs)) {
-      close();
-      return false;
-    }
-  }
+  a += prefix, b += prefix;
+  n -= prefix + suffix, m -= prefix + suffix;
 
-  close();
+  if (n == 0 || m == 0) {
+    script.insert(script.end(), n, Edit::Delete);
+    script.insert(script.end(), m, Edit::Insert);
+  } else if (n + m <= 64) {
+    myers_diff_greedy(a, n, b, m, script);
+  } else {
+    int x0, y0, x1, y1;
 
-  return true;
+    middle_snake(a, n, b, m, x0, y0, x1, y1);
+
+    myers_diff(a, x0, b, y0, script);
+    script.insert(script.end(), x1 - x0, Edit::Keep);
+    myers_diff(a + x1, n - x1, b + y1, m - y1, script);
+  }
+
+  script.insert(script.end(), suffix, Edit::Keep);
 }
 
 /*
- * Computes a hash value for a given input
- * string.
+ * Removes the lines that only one input has.
  *
- * @param someString The input string.
- * @return The computed hash value.
+ * Such lines can never be kept, so the diff engine does not need to
+ * see them. On heavily rewritten files this leaves it far less to do.
+ *
+ * @param ids1 The first ID sequence.
+ * @param ids2 The second ID sequence.
+ * @param shared1 The IDs of `ids1` that `ids2` also has (output).
+ * @param shared2 The IDs of `ids2` that `ids1` also has (output).
+ * @return Whether each ID occurs in both inputs.
  */
-size_t hash_it(string someString) {
-  return hash<string>{}(someString);
+vector<bool> drop_unshared(
+  const vector<int> &ids1, const vector<int> &ids2, vector<int> &shared1,
+  vector<int> &shared2
+) {
+  int distinct = 0;
+
+  for (int id : ids1)
+    distinct = max(distinct, id + 1);
+
+  for (int id : ids2)
+    distinct = max(distinct, id + 1);
+
+  vector<char> seen(distinct, 0);
+
+  for (int id : ids1)
+    seen[id] |= 1;
+
+  for (int id : ids2)
+    seen[id] |= 2;
+
+  vector<bool> shared(distinct);
+
+  for (int id = 0; id < distinct; ++id)
+    shared[id] = seen[id] == 3;
+
+  for (int id : ids1)
+    if (shared[id])
+      shared1.push_back(id);
+
+  for (int id : ids2)
+    if (shared[id])
+      shared2.push_back(id);
+
+  return shared;
 }
 
 /*
- * Diffs two files by hashing.
+ * Puts the lines removed by `drop_unshared` back into an edit script.
  *
- * Determines whether or not the input files contain
- * the same content by comparing the hashes of their
- * respective file contents.
+ * Each removed line is deleted or inserted right before the next
+ * shared line of its input.
  *
- * @param file1 The first input file relative path.
- * @param file2 The second input file relative path.
- * @return Whether or not the input files' contents hash to the same value.
+ * @param ids1 The first ID sequence.
+ * @param ids2 The second ID sequence.
+ * @param shared Whether each ID occurs in both inputs.
+ * @param script The edit script between the shared lines.
+ * @return The edit script turning `ids1` into `ids2`.
  */
-bool enhanced_file_diff(string file1, string file2) {
-  ifstream file1_stream(file1), file2_stream(file2);
+vector<Edit> restore_unshared(
+  const vector<int> &ids1, const vector<int> &ids2,
+  const vector<bool> &shared, const vector<Edit> &script
+) {
+  vector<Edit> full;
+
+  full.reserve(ids1.size() + ids2.size());
 
-  stringstream buffer1, buffer2;
+  size_t i = 0, j = 0;
 
-  buffer1 << file1_stream.rdbuf();
-  buffer2 << file2_stream.rdbuf();
+  for (Edit edit : script) {
+    if (edit != Edit::Insert) {
+      for (; !shared[ids1[i]]; ++i)
+        full.push_back(Edit::Delete);
+      ++i;
+    }
+
+    if (edit != Edit::Delete) {
+      for (; !shared[ids2[j]]; ++j)
+        full.push_back(Edit::Insert);
+      ++j;
+    }
 
-  bool result = hash_it(buffer1.str()) == hash_it(buffer2.str());
+    full.push_back(edit);
+  }
 
-  file1_stream.close();
-  file2_stream.close();
+  full.insert(full.end(), ids1.size() - i, Edit::Delete);
+  full.insert(full.end(), ids2.size() - j, Edit::Insert);
 
-  return result;
+  return full;
 }
 
 /*
- * Recursive helper function for `list_mismatched_lines`.
+ * Prints an edit script as unified diff hunks.
+ *
+ * Only deleted and inserted lines are printed, kept lines just advance
+ * the hunk positions.
  *
  * @param file1 The name of the first input file.
  * @param lines1 The lines in the first input file.
  * @param file2 The name of the second input file.
  * @param lines2 The lines in the second input file.
+ * @param script The edit script turning `lines1` into `lines2`.
+ */
+void print_hunks(
+  string file1, const vector<string_view> &lines1, string file2,
+  const vector<string_view> &lines2, const vector<Edit> &script
+) {
+  size_t i = 0, j = 0, k = 0;
+
+  bool header = false;
+
+  while (k < script.size()) {
+    if (script[k] == Edit::Keep) {
+      ++i, ++j, ++k;
+      continue;
+    }
+
+    size_t start = k;
+
+    while (k < script.size() && script[k] != Edit::Keep)
+      ++k;
+
+    size_t deleted =
+             count(script.begin() + start, script.begin() + k, Edit::Delete),
+           inserted = k - start - deleted;
+
+    if (!header) {
+      cout << "--- " << file1 << '\n' << "+++ " << file2 << '\n';
+      header = true;
+    }
+
+    cout << "@@ -" << (deleted ? i + 1 : i) << ',' << deleted << " +"
+         << (inserted ? j + 1 : j) << ',' << inserted << " @@\n";
+
+    for (size_t end = i + deleted; i < end; ++i)
+      cout << '-' << lines1[i] << '\n';
+
+    for (size_t end = j + inserted; j < end; ++j)
+      cout << '+' << lines2[j] << '\n';
+  }
+}
+
+/*
+ * The contents of a file, mapped when possible and read otherwise.
+ */
+class FileContents {
+  public:
+    string_view text;
+
+    FileContents(const string &file) : map(file) {
+      if (map.is_open()) {
+        text = string_view(map.data, map.size);
+      } else {
+        ifstream stream(file, ios::binary);
+        buffer.assign(istreambuf_iterator<char>(stream), {});
+        text = buffer;
+      }
+    }
+
+  private:
+    MappedFile map;
+    string buffer;
+};
+
+/*
+ * Splits text into lines, the way `getline` would.
+ *
+ * @param text The input text.
+ * @return Views of every line, without their newlines.
+ */
+vector<string_view> split_lines(string_view text) {
+  vector<string_view> lines;
+
+  while (!text.empty()) {
+    size_t end = text.find('\n');
+
+    if (end == string_view::npos) {
+      lines.push_back(text);
+      break;
+    }
+
+    lines.push_back(text.substr(0, end));
+    text.remove_prefix(end + 1);
+  }
+
+  return lines;
+}
+
+/*
+ * A part of an edit script computed by `parallel_diff`.
+ *
+ * A piece is either diffed whole into `script`, or split the way
+ * `myers_diff` splits it: `prefix` kept lines, the `left` piece,
+ * `snake` kept lines, the `right` piece and `suffix` kept lines.
  */
-void list_mismatched_lines_helper(
-  string file1, vector<string> lines1, string file2, vector<string> lines2
+struct DiffPiece {
+  vector<Edit> script;
+  int prefix, snake, suffix;
+  unique_ptr<DiffPiece> left, right;
+};
+
+/*
+ * Diffs two ID sequences into a piece, splitting large ones on a pool.
+ *
+ * A subproblem of at least `target` lines takes one step of
+ * `myers_diff`: its common prefix and suffix and the middle snake in
+ * between are kept, and the halves on either side become new pieces.
+ * The left half is handed to the pool and the right half is diffed
+ * in place. Smaller subproblems go to `myers_diff` whole.
+ *
+ * @param a The first ID sequence.
+ * @param n The length of `a`.
+ * @param b The second ID sequence.
+ * @param m The length of `b`.
+ * @param target The size below which a subproblem is not split.
+ * @param pool The pool to diff the left halves on.
+ * @param piece The piece to fill in.
+ */
+void split_diff(
+  const int *a, int n, const int *b, int m, size_t target, ThreadPool &pool,
+  DiffPiece &piece
 ) {
-  if (lines1.empty() && lines2.empty())
+  piece.prefix = piece.snake = piece.suffix = 0;
+
+  if (size_t(n) + m < target) {
+    myers_diff(a, n, b, m, piece.script);
     return;
+  }
 
-  if (!lines1.empty() && !lines2.empty()) {
-    if (hash_it(lines1.front()) != hash_it(lines2.front()))
-      cout << file1 << ": " << lines1.front() << '\n'
-           << file2 << ": " << lines2.front() << '\n';
-    ;
-    list_mismatched_lines_helper(
-      file1, vector<string>(lines1.begin() + 1, lines1.end()), file2,
-      vector<string>(lines2.begin() + 1, lines2.end())
-    );
-  } else if (lines1.empty() && !lines2.empty()) {
-    cout << file1 << ": " << '\n' << file2 << ": " << lines2.front() << '\n';
-    list_mismatched_lines_helper(
-      file1, lines1, file2, vector<string>(lines2.begin() + 1, lines2.end())
-    );
-  } else {
-    cout << file1 << ": " << lines1.front() << '\n' << file2 << ": " << '\n';
-    list_mismatched_lines_helper(
-      file1, vector<string>(lines1.begin() + 1, lines1.end()), file2, lines2
+  common_ends(a, n, b, m, piece.prefix, piece.suffix);
+
+  a += piece.prefix, b += piece.prefix;
+  n -= piece.prefix + piece.suffix, m -= piece.prefix + piece.suffix;
+
+  if (n == 0 || m == 0 || n + m <= 64) {
+    myers_diff(a, n, b, m, piece.script);
+    return;
+  }
+
+  int x0, y0, x1, y1;
+
+  middle_snake(a, n, b, m, x0, y0, x1, y1);
+
+  piece.snake = x1 - x0;
+  piece.left = make_unique<DiffPiece>();
+  piece.right = make_unique<DiffPiece>();
+
+  DiffPiece *left = piece.left.get();
+
+  pool.submit([=, &pool]() {
+    split_diff(a, x0, b, y0, target, pool, *left);
+  });
+
+  split_diff(a + x1, n - x1, b + y1, m - y1, target, pool, *piece.right);
+}
+
+/*
+ * Joins the parts of a piece into one edit script.
+ *
+ * @param piece The piece.
+ * @param script The edit script to append to.
+ */
+void join_diff(const DiffPiece &piece, vector<Edit> &script) {
+  script.insert(script.end(), piece.prefix, Edit::Keep);
+  script.insert(script.end(), piece.script.begin(), piece.script.end());
+
+  if (piece.left) {
+    join_diff(*piece.left, script);
+    script.insert(script.end(), piece.snake, Edit::Keep);
+    join_diff(*piece.right, script);
+  }
+
+  script.insert(script.end(), piece.suffix, Edit::Keep);
+}
+
+/*
+ * Computes the edit script of `myers_diff` on several threads.
+ *
+ * The inputs are only split where `myers_diff` splits them itself, at
+ * common prefixes and suffixes and around middle snakes, so the script
+ * is exactly the one it computes, whatever the number of threads.
+ *
+ * @param ids1 The first ID sequence.
+ * @param ids2 The second ID sequence.
+ * @param threads The number of threads to diff on.
+ * @return The edit script turning `ids1` into `ids2`.
+ */
+vector<Edit> parallel_diff(
+  const vector<int> &ids1, const vector<int> &ids2, size_t threads
+) {
+  size_t total = ids1.size() + ids2.size(),
+         target = max<size_t>(total / (max<size_t>(threads, 1) * 8), 1024);
+
+  DiffPiece root;
+
+  {
+    ThreadPool pool(threads);
+
+    split_diff(
+      ids1.data(), ids1.size(), ids2.data(), ids2.size(), target, pool, root
     );
+
+    pool.wait();
   }
+
+  vector<Edit> script;
+
+  script.reserve(total);
+  join_diff(root, script);
+
+  return script;
 }
 
 /*
  * Lists all lines that are different in both input
  * files.
  *
+ * Lines are matched with a Myers diff, so an inserted or deleted line
+ * only shows up once instead of shifting every line after it. Lines
+ * only one file has are set aside first. The output does not depend on
+ * the number of threads, and it is minimal unless `myers_diff` runs
+ * into `MYERS_COST_LIMIT`.
+ *
  * @param file1 The first input file relative path.
  * @param file2 The second input file relative path.
+ * @param threads The number of threads to diff on.
  */
-void list_mismatched_lines(string file1, string file2) {
-  ifstream file1_stream(file1), file2_stream(file2);
+void list_mismatched_lines(string file1, string file2, size_t threads = 1) {
+  FileContents contents1(file1), contents2(file2);
 
-  string str;
+  vector<string_view> lines1 = split_lines(contents1.text),
+                      lines2 = split_lines(contents2.text);
 
-  vector<string> lines1, lines2;
+  vector<int> ids1, ids2, shared1, shared2;
 
-  while (getline(file1_stream, str))
-    lines1.push_back(str);
+  intern_lines(lines1, lines2, ids1, ids2);
 
-  while (getline(file2_stream, str))
-    lines2.push_back(str);
+  vector<bool> shared = drop_unshared(ids1, ids2, shared1, shared2);
 
-  list_mismatched_lines_helper(
+  print_hunks(
     filesystem::path(file1).filename(), lines1,
-    filesystem::path(file2).filename(), lines2
+    filesystem::path(file2).filename(), lines2,
+    restore_unshared(
+      ids1, ids2, shared, parallel_diff(shared1, shared2, threads)
+    )
   );
-
-  file1_stream.close();
-  file2_stream.close();
 }
 
 /*
- * A recursive helper function for `list_mismatched_words`.
+ * Reads the words of a stream one at a time.
+ *
+ * The underlying stream reads through a fixed-size buffer, so memory
+ * use does not depend on the size of the file. Used for files that
+ * cannot be mapped.
+ */
+class WordReader {
+  public:
+    string word;
+    uint32_t line;
+
+    WordReader(string file) {
+      this->line = 1;
+      stream.rdbuf()->pubsetbuf(buffer, sizeof(buffer));
+      stream.open(file);
+    }
+
+    /*
+     * Advance to the next word.
+     *
+     * @return Whether or not a word was read.
+     */
+    bool next() {
+      int c;
+
+      while ((c = stream.peek()) != EOF && is_space(c)) {
+        line += c == '\n';
+        stream.get();
+      }
+
+      return static_cast<bool>(stream >> word);
+    }
+
+  private:
+    char buffer[1 << 16];
+    ifstream stream;
+};
+
+/*
+ * Reads the words of a mapped file one at a time.
+ */
+class SpanReader {
+  public:
+    string_view word;
+    uint32_t line;
+
+    SpanReader(MappedFile &file) : tokens(file.data, file.size) {
+      this->data = file.data;
+      this->line = 1;
+    }
+
+    /*
+     * Advance to the next word.
+     *
+     * @return Whether or not a word was read.
+     */
+    bool next() {
+      Span span;
+
+      if (!tokens.next(span))
+        return false;
+
+      word = string_view(data + span.offset, span.length);
+      line = span.line;
+
+      return true;
+    }
+
+  private:
+    const char *data;
+    Tokenizer tokens;
+};
+
+/*
+ * Prints the mismatched words of two word readers.
+ *
+ * Both readers are advanced in lockstep and mismatches are printed as
+ * soon as they are found.
  *
  * @param file1 The first input file name.
- * @param words1 The words present in the first input file.
+ * @param reader1 The words of the first input file.
  * @param file2 The second input file name.
- * @param words2 The words present in the second input file.
+ * @param reader2 The words of the second input file.
  */
-void list_mismatched_words_helper(
-  string file1, vector<pair<string, int>> words1, string file2,
-  vector<pair<string, int>> words2
+template <typename Reader>
+void print_mismatched_words(
+  string file1, Reader &reader1, string file2, Reader &reader2
 ) {
-  if (words1.empty() && words2.empty())
-    return;
+  bool has1 = reader1.next(), has2 = reader2.next();
 
-  if (!words1.empty() && !words2.empty()) {
-    if (hash_it(words1.front().first) != hash_it(words2.front().first))
-      cout << file1 << ": " << words1.front().first << " (line "
-           << words1.front().second << ")\n"
-           << file2 << ": " << words2.front().first << " (line "
-           << words2.front().second << ")\n";
-    list_mismatched_words_helper(
-      file1, vector<pair<string, int>>(words1.begin() + 1, words1.end()), file2,
-      vector<pair<string, int>>(words2.begin() + 1, words2.end())
-    );
-  } else if (words1.empty() && !words2.empty()) {
-    cout << file1 << ":\n"
-         << file2 << ": " << words2.front().first << " (line "
-         << words2.front().second << ")\n";
-    list_mismatched_words_helper(
-      file1, words1, file2,
-      vector<pair<string, int>>(words2.begin() + 1, words2.end())
-    );
-  } else {
-    cout << file1 << ": " << words1.front().first << " (line "
-         << words1.front().second << ")\n"
-         << file2 << ":\n";
-    list_mismatched_words_helper(
-      file1, vector<pair<string, int>>(words1.begin() + 1, words1.end()), file2,
-      words2
-    );
+  while (has1 || has2) {
+    if (has1 && has2) {
+      if (hash_it(reader1.word) != hash_it(reader2.word))
+        cout << file1 << ": " << reader1.word << " (line " << reader1.line
+             << ")\n"
+             << file2 << ": " << reader2.word << " (line " << reader2.line
+             << ")\n";
+    } else if (has2) {
+      cout << file1 << ":\n"
+           << file2 << ": " << reader2.word << " (line " << reader2.line
+           << ")\n";
+    } else {
+      cout << file1 << ": " << reader1.word << " (line " << reader1.line
+           << ")\n"
+           << file2 << ":\n";
+    }
+
+    if (has1)
+      has1 = reader1.next();
+
+    if (has2)
+      has2 = reader2.next();
   }
 }
 
@@ -204,37 +1793,225 @@ void list_mismatched_words_helper(
  * A function that lists all mismatched words in the given
  * input files.
  *
+ * Regular files are tokenized straight out of memory mappings,
+ * anything else is read through streams.
+ *
  * @param file1 The relative path of the first input file.
  * @param file2 The relative path of the second input file.
  */
 void list_mismatched_words(string file1, string file2) {
-  ifstream file1_stream(file1), file2_stream(file2);
+  string name1 = filesystem::path(file1).filename(),
+         name2 = filesystem::path(file2).filename();
+
+  MappedFile map1(file1), map2(file2);
+
+  if (map1.is_open() && map2.is_open()) {
+    SpanReader reader1(map1), reader2(map2);
+    print_mismatched_words(name1, reader1, name2, reader2);
+  } else {
+    WordReader reader1(file1), reader2(file2);
+    print_mismatched_words(name1, reader1, name2, reader2);
+  }
+}
+
+/*
+ * Lists the regular files below a directory.
+ *
+ * @param dir The directory to walk.
+ * @return The sorted paths of all files, relative to `dir`.
+ */
+vector<string> list_files(const string &dir) {
+  vector<string> files;
+
+  error_code error;
 
-  string str;
+  for (auto it = filesystem::recursive_directory_iterator(dir, error);
+       it != filesystem::recursive_directory_iterator(); it.increment(error)) {
+    if (it->is_regular_file(error))
+      files.push_back(it->path().lexically_relative(dir).string());
+  }
+
+  sort(files.begin(), files.end());
+
+  return files;
+}
+
+/*
+ * Diffs two directory trees.
+ *
+ * Files are paired by their path relative to each root. Files only
+ * found in the second tree are reported as added, files only found in
+ * the first as removed, and pairs whose contents differ according to
+ * `enhanced_file_diff` as changed. Pairs are compared on a thread pool.
+ *
+ * @param dir1 The first directory relative path.
+ * @param dir2 The second directory relative path.
+ * @param list_lines Whether or not to list the lines of changed files.
+ * @param threads The number of comparison threads.
+ * @return Whether or not both trees hold the same files.
+ */
+bool tree_diff(
+  string dir1, string dir2, bool list_lines = false,
+  size_t threads = thread::hardware_concurrency()
+) {
+  vector<string> files1 = list_files(dir1), files2 = list_files(dir2);
 
-  vector<pair<string, int>> words1, words2;
+  vector<pair<string, char>> entries;
 
-  int curr = 1;
+  size_t i = 0, j = 0;
 
-  while (file1_stream >> str) {
-    words1.push_back(make_pair(str, curr));
-    curr += file1_stream.peek() == '\n';
+  while (i < files1.size() || j < files2.size()) {
+    if (j == files2.size() || (i < files1.size() && files1[i] < files2[j]))
+      entries.push_back(make_pair(files1[i++], '-'));
+    else if (i == files1.size() || files2[j] < files1[i])
+      entries.push_back(make_pair(files2[j++], '+'));
+    else
+      entries.push_back(make_pair(files1[i++], '=')), ++j;
   }
 
-  curr = 1;
+  {
+    ThreadPool pool(threads);
+
+    for (auto &entry : entries) {
+      if (entry.second != '=')
+        continue;
+
+      pool.submit([&]() {
+        string path1 = (filesystem::path(dir1) / entry.first).string(),
+               path2 = (filesystem::path(dir2) / entry.first).string();
 
-  while (file2_stream >> str) {
-    words2.push_back(make_pair(str, curr));
-    curr += file2_stream.peek() == '\n';
+        if (!enhanced_file_diff(path1, path2))
+          entry.second = '~';
+      });
+    }
+
+    pool.wait();
   }
 
-  list_mismatched_words_helper(
-    filesystem::path(file1).filename(), words1,
-    filesystem::path(file2).filename(), words2
-  );
+  bool same = true;
+
+  for (auto &[file, status] : entries) {
+    if (status != '=')
+      same = false;
+
+    if (status == '+')
+      cout << "Added: " << file << '\n';
+    else if (status == '-')
+      cout << "Removed: " << file << '\n';
+    else if (status == '~') {
+      cout << "Changed: " << file << '\n';
+
+      if (list_lines)
+        list_mismatched_lines(
+          (filesystem::path(dir1) / file).string(),
+          (filesystem::path(dir2) / file).string()
+        );
+    }
+  }
+
+  return same;
+}
+
+/*
+ * The number of leading bytes hashed to split files of equal size.
+ */
+const size_t PREFIX_SIZE = 4096;
+
+/*
+ * Finds every group of identical files below a directory.
+ *
+ * Files are first bucketed by size, then files sharing a size are
+ * split by the hash of their first `PREFIX_SIZE` bytes, and only files
+ * that still collide are hashed in full. Each stage runs on a thread
+ * pool, and most files are never read past their first block. Files
+ * that cannot be examined or opened are left out.
+ *
+ * @param dir The directory relative path.
+ * @param threads The number of hashing threads.
+ */
+void find_duplicate_files(
+  string dir, size_t threads = thread::hardware_concurrency()
+) {
+  vector<string> files = list_files(dir);
+
+  vector<string> paths;
 
-  file1_stream.close();
-  file2_stream.close();
+  for (const string &file : files)
+    paths.push_back((filesystem::path(dir) / file).string());
+
+  vector<uintmax_t> sizes(files.size());
+  vector<char> skipped(files.size(), 0);
+
+  ThreadPool pool(threads);
+
+  auto refine = [&](const vector<vector<size_t>> &groups, auto key) {
+    vector<Hash128> keys(files.size());
+
+    for (const vector<size_t> &group : groups)
+      for (size_t i : group)
+        pool.submit([&, i]() { keys[i] = key(i); });
+
+    pool.wait();
+
+    vector<vector<size_t>> result;
+
+    for (const vector<size_t> &group : groups) {
+      map<pair<uint64_t, uint64_t>, vector<size_t>> split;
+
+      for (size_t i : group)
+        if (!skipped[i])
+          split[make_pair(keys[i].low, keys[i].high)].push_back(i);
+
+      for (auto &[_, members] : split)
+        if (members.size() > 1)
+          result.push_back(move(members));
+    }
+
+    return result;
+  };
+
+  vector<vector<size_t>> groups(1);
+
+  for (size_t i = 0; i < files.size(); ++i)
+    groups[0].push_back(i);
+
+  groups = refine(groups, [&](size_t i) {
+    struct stat info;
+
+    if (stat(paths[i].c_str(), &info) != 0)
+      skipped[i] = 1;
+    else
+      sizes[i] = info.st_size;
+
+    return Hash128{sizes[i], 0};
+  });
+
+  groups = refine(groups, [&](size_t i) {
+    Hash128 hash{0, 0};
+
+    if (!hash_file(paths[i], hash, PREFIX_SIZE))
+      skipped[i] = 1;
+
+    return hash;
+  });
+
+  groups = refine(groups, [&](size_t i) {
+    Hash128 hash{0, 0};
+
+    if (sizes[i] > PREFIX_SIZE && !hash_file(paths[i], hash))
+      skipped[i] = 1;
+
+    return hash;
+  });
+
+  sort(groups.begin(), groups.end());
+
+  for (const vector<size_t> &group : groups) {
+    cout << "Identical files (" << sizes[group.front()] << " bytes):\n";
+
+    for (size_t i : group)
+      cout << "  " << files[i] << '\n';
+  }
 }
 
 /*
@@ -281,4 +2058,17 @@ int main() {
   list_mismatched_words(
     file1, file2
   ); // This should print to the screen the mismatched words
+
+  // Q7
+  string dir = "./txt_folder";
+
+  result = tree_diff(dir, dir); // True
+  assert(result);
+
+  // Q8
+  find_duplicate_files(
+    dir
+  ); // This should print to the screen the groups of identical files
+
+  return 0;
 }
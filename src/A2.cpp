@@ -36,17 +36,21 @@ const char *FILENAME = "file.txt";
 
 /*
  * A single file version.
+ *
+ * `prev` and `next` are the slots of the neighbouring versions in the
+ * owning list's ordering, or -1 at either end.
  */
 class Node {
   public:
-    Node *next;
+    int prev, next;
     int version;
     string content;
 
-    Node(int version, string content, Node *next) {
+    Node(int version, string content) {
+      this->prev = -1;
+      this->next = -1;
       this->version = version;
       this->content = content;
-      this->next = next;
     }
 
     /*
@@ -77,28 +81,27 @@ ostream &operator<<(ostream &outs, Node *node) {
 
 /*
  * A list of file versions.
+ *
+ * Nodes live in a contiguous array of slots and are found through a
+ * version to slot map. The versions are ordered by when they were last
+ * made current, through intrusive links between slots, with the
+ * currently loaded version at the head.
  */
 class List {
   private:
-    Node *head;
+    vector<Node> nodes;
+    vector<int> free_slots;
+    unordered_map<int, int> slots;
+    int head;
     int version;
 
     /*
-     * Get the length of this linked list.
+     * Get the number of versions in this list.
      *
      * @return The length of the list.
      */
     int length() {
-      int ans = 0;
-
-      Node *curr = head;
-
-      while (curr != nullptr) {
-        ++ans;
-        curr = curr->next;
-      }
-
-      return ans;
+      return slots.size();
     }
 
     /*
@@ -108,15 +111,75 @@ class List {
      * @return The node with the specified version.
      */
     Node *find(int version) {
-      Node *curr = head;
+      auto it = slots.find(version);
+      return it == slots.end() ? nullptr : &nodes[it->second];
+    }
+
+    /*
+     * Get the slot a node is stored in.
+     *
+     * @param node A node of this list.
+     * @return The node's slot.
+     */
+    int slot_of(Node *node) {
+      return node - nodes.data();
+    }
+
+    /*
+     * Detach a node from the version ordering.
+     *
+     * @param slot The node's slot.
+     */
+    void unlink(int slot) {
+      Node &node = nodes[slot];
+
+      if (node.prev != -1)
+        nodes[node.prev].next = node.next;
+      else
+        head = node.next;
+
+      if (node.next != -1)
+        nodes[node.next].prev = node.prev;
 
-      while (curr != nullptr) {
-        if (curr->version == version)
-          return curr;
-        curr = curr->next;
+      node.prev = node.next = -1;
+    }
+
+    /*
+     * Make a detached node the currently loaded version.
+     *
+     * @param slot The node's slot.
+     */
+    void push_front(int slot) {
+      nodes[slot].next = head;
+
+      if (head != -1)
+        nodes[head].prev = slot;
+
+      head = slot;
+    }
+
+    /*
+     * Store a new node in a free slot and make it the currently loaded
+     * version.
+     *
+     * @param version The file's version.
+     * @param content The file's content.
+     */
+    void insert(int version, string content) {
+      int slot;
+
+      if (free_slots.empty()) {
+        slot = nodes.size();
+        nodes.emplace_back(version, content);
+      } else {
+        slot = free_slots.back();
+        free_slots.pop_back();
+        nodes[slot] = Node(version, content);
       }
 
-      return nullptr;
+      slots[version] = slot;
+
+      push_front(slot);
     }
 
   public:
@@ -124,52 +187,36 @@ class List {
      * Default constructor.
      */
     List() {
-      this->head = nullptr;
+      this->head = -1;
       this->version = 1;
     }
 
     /*
      * Add a new file version to the list.
      *
-     * => Adds a new node to the front of the linked list.
+     * => Adds a new node to the front of the list.
      *
      * @param content The file's content.
      */
     void add(string content) {
-      Node *curr = head;
-
-      if (curr == nullptr) {
-        head = new Node(version++, content, nullptr);
-        return;
-      }
-
-      if (head->content == content) {
+      if (head != -1 && nodes[head].content == content) {
         cout << "git322 did not detect any change to your file and will not "
                 "create a new version."
              << "\n";
         return;
       }
 
-      curr = new Node(version++, content, head);
-
-      head = curr;
+      insert(version++, content);
     }
 
     /*
      * Print list information
      */
     void print() {
-      Node *curr = head;
-
       cout << "Number of versions: " << length() << '\n';
 
-      if (curr == nullptr)
-        return;
-
-      while (curr != nullptr) {
-        cout << curr << '\n';
-        curr = curr->next;
-      }
+      for (int slot = head; slot != -1; slot = nodes[slot].next)
+        cout << &nodes[slot] << '\n';
     }
 
     /*
@@ -192,32 +239,26 @@ class List {
         return;
       }
 
-      if (curr == head) {
+      int slot = slot_of(curr);
+
+      if (slot == head) {
         cout << "Version " << version
              << " is already the currently loaded version." << '\n';
         return;
       }
 
-      if (curr != head) {
-        Node *temp = head;
+      unlink(slot);
+      push_front(slot);
 
-        while (temp->next != curr)
-          temp = temp->next;
+      ofstream file;
+      file.open(FILENAME);
+      file << curr->content;
+      file.close();
 
-        temp->next = curr->next;
-        curr->next = head;
-        head = curr;
-
-        ofstream file;
-        file.open(FILENAME);
-        file << head->content;
-        file.close();
-
-        cout << "Version " << version
-             << " loaded successfully. Please refresh your text editor to see "
-                "the changes."
-             << '\n';
-      }
+      cout << "Version " << version
+           << " loaded successfully. Please refresh your text editor to see "
+              "the changes."
+           << '\n';
     }
 
     /**
@@ -289,20 +330,16 @@ class List {
      * @param keyword The keyword to look for.
      */
     void search(string keyword) {
-      Node *curr = head;
+      vector<Node *> found;
 
-      vector<Node *> nodes;
+      for (int slot = head; slot != -1; slot = nodes[slot].next)
+        if (nodes[slot].contains(keyword))
+          found.push_back(&nodes[slot]);
 
-      while (curr != nullptr) {
-        if (curr->contains(keyword))
-          nodes.push_back(curr);
-        curr = curr->next;
-      }
-
-      if (!nodes.empty()) {
+      if (!found.empty()) {
         cout << "The keyword " << keyword
              << " has been found in the following versions:" << '\n';
-        for (auto node : nodes)
+        for (auto node : found)
           cout << node << '\n';
       } else
         cout << "Your keyword '" << keyword << "' was not found in any version."
@@ -322,39 +359,24 @@ class List {
         return;
       }
 
-      bool was_active = curr == head;
+      int slot = slot_of(curr);
 
-      if (was_active) {
-        head = head->next;
-      } else {
-        Node *temp = head;
-        while (temp->next != curr)
-          temp = temp->next;
-        temp->next = curr->next;
-      }
+      bool was_active = slot == head;
 
-      if (was_active && head != nullptr) {
+      unlink(slot);
+      slots.erase(version);
+      curr->content = string();
+      free_slots.push_back(slot);
+
+      if (was_active && head != -1) {
         ofstream file;
         file.open(FILENAME);
-        file << head->content;
+        file << nodes[head].content;
         file.close();
       }
 
-      delete curr;
-
       cout << "Version " << version << " deleted successfully." << '\n';
     }
-
-    /*
-     * List destructor.
-     */
-    ~List() {
-      while (head != nullptr) {
-        Node *curr = head;
-        head = head->next;
-        delete curr;
-      }
-    }
 };
 
 /*
@@ -1,195 +1,3320 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <fcntl.h>
+#include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <sstream>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
 #include <unordered_map>
 #include <vector>
 
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 using namespace std;
 
 /*
- * A single file version.
+ * The magic bytes at the start of a database file.
  */
-class Node {
-  public:
-    Node *next;
-    int version;
-    string content;
+const char DB_MAGIC[] = "GIT322DB";
 
-    Node(int version, string content, Node *next) {
-      this->version = version;
-      this->content = content;
-      this->next = next;
+/*
+ * The database format written by `List::serialize`.
+ *
+ * Format 1 holds fixed tables of chunks and versions that are read
+ * through a memory mapping. Databases without the magic bytes (format
+ * 0) hold the full content of each version.
+ */
+const int DB_FORMAT = 1;
+
+/*
+ * The journal size past which it is compacted into the database.
+ */
+const uint64_t JOURNAL_LIMIT = 16 << 20;
+
+/*
+ * The default number of bytes of decoded contents kept in memory.
+ */
+const size_t CACHE_BUDGET = 64 << 20;
+
+/*
+ * How long a file's stat must have been stable, in nanoseconds, before
+ * it is recorded. A file written twice within its file system's
+ * timestamp granularity may keep the same stat.
+ */
+const int64_t STAT_SETTLE_NS = 2000000000;
+
+/*
+ * The size of the blocks a checkout compares and rewrites, and of the
+ * window of the tracked file it reads at a time.
+ */
+const size_t CHECKOUT_BLOCK = 4096, CHECKOUT_WINDOW = 1 << 20;
+
+/*
+ * Content-defined chunk size bounds.
+ */
+const size_t CHUNK_MIN = 2048, CHUNK_AVG = 8192, CHUNK_MAX = 65536;
+
+/*
+ * The FastCDC boundary masks used before and after a chunk reaches
+ * `CHUNK_AVG` bytes, which keep chunk sizes close to the average.
+ */
+const uint64_t CHUNK_MASK_S = 0x0003590703530000ULL,
+               CHUNK_MASK_L = 0x0000d90003530000ULL;
+
+/*
+ * The Gear hash's per-byte values, generated from a fixed seed so that
+ * chunk boundaries are the same in every run.
+ */
+const array<uint64_t, 256> GEAR = [] {
+  array<uint64_t, 256> table{};
+  uint64_t state = 0;
+
+  for (auto &value : table) {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    value = z ^ (z >> 31);
+  }
+
+  return table;
+}();
+
+/*
+ * Stop the program over a damaged database.
+ *
+ * => Every change is in the journal before it is made, so stopping
+ * loses nothing, whereas carrying on could snapshot the damage over the
+ * database.
+ *
+ * @param message What is damaged.
+ */
+[[noreturn]] void fail(const string &message) {
+  cout.flush();
+  cerr << "git322: " << message
+       << ". The database may be damaged; move it away to start over."
+       << '\n';
+  _exit(1);
+}
+
+/*
+ * Append the bytes of a plain value.
+ *
+ * @param out The output buffer.
+ * @param value The value.
+ */
+template <typename T> void put_value(string &out, T value) {
+  out.append(reinterpret_cast<char *>(&value), sizeof(value));
+}
+
+/*
+ * Read the bytes of a plain value.
+ *
+ * @param in The input buffer.
+ * @param pos The read position, advanced past the value.
+ * @return The value.
+ */
+template <typename T> T get_value(string_view in, size_t &pos) {
+  T value;
+  memcpy(&value, in.data() + pos, sizeof(value));
+  pos += sizeof(value);
+  return value;
+}
+
+/*
+ * XXH64 primes.
+ */
+const uint64_t XXH_PRIME1 = 0x9e3779b185ebca87ULL,
+               XXH_PRIME2 = 0xc2b2ae3d27d4eb4fULL,
+               XXH_PRIME3 = 0x165667b19e3779f9ULL,
+               XXH_PRIME4 = 0x85ebca77c2b2ae63ULL,
+               XXH_PRIME5 = 0x27d4eb2f165667c5ULL;
+
+/*
+ * Rotate a 64-bit integer left by `r` bits.
+ */
+inline uint64_t rotl64(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+/*
+ * Mix 8 input bytes into an XXH64 accumulator lane.
+ */
+inline uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+  return rotl64(acc + input * XXH_PRIME2, 31) * XXH_PRIME1;
+}
+
+/*
+ * Fold an XXH64 accumulator lane into the hash.
+ */
+inline uint64_t xxh64_merge(uint64_t acc, uint64_t value) {
+  return (acc ^ xxh64_round(0, value)) * XXH_PRIME1 + XXH_PRIME4;
+}
+
+/*
+ * Read 8 bytes as a little-endian integer.
+ */
+inline uint64_t read64(const char *p) {
+  uint64_t value;
+  memcpy(&value, p, 8);
+  return value;
+}
+
+/*
+ * Mix the last bytes of the input into an XXH64 hash and finish it.
+ *
+ * @param h The hash so far, including the input length.
+ * @param p The bytes left over after the last full stripe.
+ * @param end The end of the bytes.
+ * @return The finished hash.
+ */
+uint64_t xxh64_finish(uint64_t h, const char *p, const char *end) {
+  for (; p + 8 <= end; p += 8)
+    h = rotl64(h ^ xxh64_round(0, read64(p)), 27) * XXH_PRIME1 + XXH_PRIME4;
+
+  if (p + 4 <= end) {
+    uint32_t value;
+    memcpy(&value, p, 4);
+    h = rotl64(h ^ (value * XXH_PRIME1), 23) * XXH_PRIME2 + XXH_PRIME3;
+    p += 4;
+  }
+
+  for (; p < end; ++p)
+    h = rotl64(h ^ ((unsigned char)*p * XXH_PRIME5), 11) * XXH_PRIME1;
+
+  h ^= h >> 33;
+  h *= XXH_PRIME2;
+  h ^= h >> 29;
+  h *= XXH_PRIME3;
+  return h ^ (h >> 32);
+}
+
+/*
+ * Hash bytes with XXH64.
+ *
+ * => The result only depends on the bytes, not on the build, so it can
+ * be stored in the database. The four accumulator lanes run
+ * independently, which keeps the hash at memory speed.
+ *
+ * @param data The bytes.
+ * @param seed The hash seed.
+ * @return The 64-bit hash of the bytes.
+ */
+uint64_t xxh64(string_view data, uint64_t seed = 0) {
+  const char *p = data.data(), *end = p + data.size();
+
+  uint64_t h;
+
+  if (data.size() >= 32) {
+    uint64_t v1 = seed + XXH_PRIME1 + XXH_PRIME2, v2 = seed + XXH_PRIME2,
+             v3 = seed, v4 = seed - XXH_PRIME1;
+
+    for (; p + 32 <= end; p += 32) {
+      v1 = xxh64_round(v1, read64(p));
+      v2 = xxh64_round(v2, read64(p + 8));
+      v3 = xxh64_round(v3, read64(p + 16));
+      v4 = xxh64_round(v4, read64(p + 24));
+    }
+
+    h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+    h = xxh64_merge(h, v1);
+    h = xxh64_merge(h, v2);
+    h = xxh64_merge(h, v3);
+    h = xxh64_merge(h, v4);
+  } else
+    h = seed + XXH_PRIME5;
+
+  return xxh64_finish(h + data.size(), p, end);
+}
+
+/*
+ * An incremental XXH64 hash.
+ *
+ * Data can be fed in pieces of any size, the digest is the `xxh64` of
+ * the concatenated bytes.
+ */
+class StreamHasher {
+  public:
+    StreamHasher(uint64_t seed = 0) {
+      this->seed = seed;
+      this->lanes[0] = seed + XXH_PRIME1 + XXH_PRIME2;
+      this->lanes[1] = seed + XXH_PRIME2;
+      this->lanes[2] = seed;
+      this->lanes[3] = seed - XXH_PRIME1;
+      this->total = 0;
+      this->buffered = 0;
     }
 
     /*
-     * Retrieve the hash value of the nodes contents.
+     * Feed more bytes into the hash.
+     *
+     * @param data The bytes.
      */
-    size_t get_hash() {
-      return hash<string>{}(this->content);
+    void update(string_view data) {
+      const char *p = data.data(), *end = p + data.size();
+
+      total += data.size();
+
+      if (buffered > 0) {
+        size_t used = min<size_t>(32 - buffered, end - p);
+        memcpy(buffer + buffered, p, used);
+        buffered += used;
+        p += used;
+
+        if (buffered < 32)
+          return;
+
+        consume(buffer);
+        buffered = 0;
+      }
+
+      for (; end - p >= 32; p += 32)
+        consume(p);
+
+      memcpy(buffer, p, end - p);
+      buffered = end - p;
     }
 
     /*
-     * Check if this nodes' content contains the input string.
+     * Get the hash of every byte fed so far.
      *
-     * @return Whether or not `keyword` is present in this nodes content.
+     * @return The 64-bit hash.
+     */
+    uint64_t digest() const {
+      uint64_t h;
+
+      if (total >= 32) {
+        h = rotl64(lanes[0], 1) + rotl64(lanes[1], 7) + rotl64(lanes[2], 12) +
+            rotl64(lanes[3], 18);
+
+        for (uint64_t lane : lanes)
+          h = xxh64_merge(h, lane);
+      } else
+        h = seed + XXH_PRIME5;
+
+      return xxh64_finish(h + total, buffer, buffer + buffered);
+    }
+
+  private:
+    uint64_t seed, lanes[4], total;
+    char buffer[32];
+    size_t buffered;
+
+    /*
+     * Mix a full 32-byte stripe into the lanes.
      */
-    bool contains(string keyword) {
-      return content.find(keyword) != string::npos;
+    void consume(const char *p) {
+      for (int i = 0; i < 4; ++i)
+        lanes[i] = xxh64_round(lanes[i], read64(p + 8 * i));
     }
 };
 
 /*
- * Overloaded `<<` operator for a `Node` instance.
+ * Hash a chunk of bytes.
+ *
+ * @param data The bytes.
+ * @return A 64-bit hash of the bytes.
  */
-ostream &operator<<(ostream &outs, Node *node) {
-  return outs << "Version number: " << node->version << '\n'
-              << "Hash value: " << node->get_hash() << '\n'
-              << "Content: " << node->content;
+uint64_t chunk_hash(string_view data) {
+  const uint64_t k1 = 0x9e3779b97f4a7c15ULL, k2 = 0xc2b2ae3d27d4eb4fULL;
+
+  uint64_t h = data.size() * k1;
+  size_t i = 0;
+
+  for (; i + 8 <= data.size(); i += 8) {
+    uint64_t word;
+    memcpy(&word, data.data() + i, 8);
+    h = (h ^ (word * k2)) * k1;
+    h ^= h >> 29;
+  }
+
+  for (; i < data.size(); ++i)
+    h = (h ^ (unsigned char)data[i]) * k2;
+
+  h ^= h >> 32;
+  h *= k1;
+  return h ^ (h >> 29);
 }
 
 /*
- * A list of file versions.
+ * Chunk codec tags in the database.
  */
-class List {
-  private:
-    Node *head;
-    int version;
-    string filename;
+const uint8_t CODEC_RAW = 0, CODEC_LZ = 1;
 
-    /*
-     * Get the length of this linked list.
-     *
-     * @return The length of the list.
-     */
-    int length() {
-      int ans = 0;
+/*
+ * The number of bits in the LZ compressor's match finder table.
+ */
+const int LZ_HASH_BITS = 12;
+
+/*
+ * Append a sequence length beyond its 4-bit token field.
+ */
+void put_lz_length(string &out, size_t length) {
+  for (; length >= 255; length -= 255)
+    out += char(255);
+
+  out += char(length);
+}
+
+/*
+ * Compress bytes in the LZ4 block format.
+ *
+ * => Finds matches through a table of the last position of each hashed
+ * 4-byte sequence. Each sequence is a token holding the literal and
+ * match lengths, the literals, and a 16-bit match offset. The last 5
+ * bytes are always literals.
+ *
+ * @param in The bytes, at most 64 KiB.
+ * @return The compressed bytes.
+ */
+string lz_compress(string_view in) {
+  string out;
+  out.reserve(in.size() + in.size() / 255 + 16);
+
+  const char *src = in.data();
+  size_t n = in.size(), anchor = 0;
+
+  auto emit = [&](size_t literal_end, size_t offset, size_t match) {
+    size_t literal = literal_end - anchor;
+
+    size_t token = min<size_t>(literal, 15) << 4;
+    if (match)
+      token |= min<size_t>(match - 4, 15);
+    out += char(token);
+
+    if (literal >= 15)
+      put_lz_length(out, literal - 15);
+    out.append(src + anchor, literal);
+
+    if (!match)
+      return;
+
+    out += char(offset & 0xff);
+    out += char(offset >> 8);
+
+    if (match - 4 >= 15)
+      put_lz_length(out, match - 4 - 15);
+  };
+
+  if (n > 12) {
+    vector<uint32_t> table(1 << LZ_HASH_BITS);
+
+    for (size_t i = 0; i < n - 12;) {
+      uint32_t sequence, candidate_sequence;
+      memcpy(&sequence, src + i, 4);
+
+      uint32_t slot = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+      size_t candidate = table[slot];
+      table[slot] = i;
+
+      memcpy(&candidate_sequence, src + candidate, 4);
+
+      if (candidate >= i || i - candidate > 65535 ||
+          candidate_sequence != sequence) {
+        ++i;
+        continue;
+      }
+
+      size_t length = 4;
+
+      while (i + length < n - 5 && src[candidate + length] == src[i + length])
+        ++length;
+
+      while (i > anchor && candidate > 0 && src[i - 1] == src[candidate - 1])
+        --i, --candidate, ++length;
+
+      emit(i, i - candidate, length);
+      anchor = i += length;
+    }
+  }
+
+  emit(n, 0, 0);
+
+  return out;
+}
+
+/*
+ * Decompress bytes produced by `lz_compress`.
+ *
+ * @param in The compressed bytes.
+ * @param out The output buffer.
+ * @param size The decompressed size.
+ * @return Whether or not `in` was valid and decompressed to `size`
+ * bytes.
+ */
+bool lz_decompress(string_view in, char *out, size_t size) {
+  size_t ip = 0, op = 0;
+
+  auto get_length = [&](size_t &length) {
+    unsigned char byte;
+    do {
+      if (ip >= in.size())
+        return false;
+      byte = in[ip++];
+      length += byte;
+    } while (byte == 255);
+    return true;
+  };
+
+  while (ip < in.size()) {
+    unsigned char token = in[ip++];
+
+    size_t literal = token >> 4, match = token & 15;
+
+    if (literal == 15 && !get_length(literal))
+      return false;
+
+    if (literal > in.size() - ip || literal > size - op)
+      return false;
+
+    memcpy(out + op, in.data() + ip, literal);
+    ip += literal;
+    op += literal;
+
+    if (ip == in.size())
+      break;
+
+    if (in.size() - ip < 2)
+      return false;
+
+    size_t offset = (unsigned char)in[ip] | (unsigned char)in[ip + 1] << 8;
+    ip += 2;
+
+    if (match == 15 && !get_length(match))
+      return false;
+
+    match += 4;
+
+    if (offset == 0 || offset > op || match > size - op)
+      return false;
+
+    if (offset >= match)
+      memcpy(out + op, out + op - offset, match);
+    else
+      for (size_t i = 0; i < match; ++i)
+        out[op + i] = out[op + i - offset];
+
+    op += match;
+  }
+
+  return op == size;
+}
+
+/*
+ * Find the end of the chunk at the start of some bytes.
+ *
+ * => Rolls a Gear hash over the bytes and cuts where its masked bits
+ * are all zero, so boundaries follow the content and an edit only moves
+ * the boundaries around it.
+ *
+ * @param data The bytes.
+ * @param size The number of bytes.
+ * @return The length of the first chunk.
+ */
+size_t next_cut(const char *data, size_t size) {
+  if (size <= CHUNK_MIN)
+    return size;
+
+  size_t normal = min(size, CHUNK_AVG), end = min(size, CHUNK_MAX);
+  size_t i = CHUNK_MIN;
+  uint64_t fingerprint = 0;
+
+  for (; i < normal; ++i) {
+    fingerprint = (fingerprint << 1) + GEAR[(unsigned char)data[i]];
+    if (!(fingerprint & CHUNK_MASK_S))
+      return i + 1;
+  }
+
+  for (; i < end; ++i) {
+    fingerprint = (fingerprint << 1) + GEAR[(unsigned char)data[i]];
+    if (!(fingerprint & CHUNK_MASK_L))
+      return i + 1;
+  }
+
+  return end;
+}
+
+#if defined(__SSE2__)
+/*
+ * Checks whether or not `needle` occurs in `haystack` with SSE2.
+ *
+ * => Compares 16 positions at once against the needle's first and last
+ * bytes, and only fully compares positions where both match.
+ *
+ * @param haystack The bytes to search.
+ * @param needle The bytes to look for, at least one.
+ * @return Whether or not `needle` occurs in `haystack`.
+ */
+bool contains_sse2(string_view haystack, string_view needle) {
+  const char *h = haystack.data();
+  size_t n = haystack.size(), k = needle.size(), i = 0;
+
+  __m128i first = _mm_set1_epi8(needle[0]), last = _mm_set1_epi8(needle[k - 1]);
+
+  for (; i + k - 1 + 16 <= n; i += 16) {
+    __m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i *>(h + i)),
+            tail =
+              _mm_loadu_si128(reinterpret_cast<const __m128i *>(h + i + k - 1));
+
+    unsigned mask = _mm_movemask_epi8(
+      _mm_and_si128(_mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, last))
+    );
+
+    for (; mask; mask &= mask - 1) {
+      size_t pos = i + __builtin_ctz(mask);
+      if (k <= 2 || !memcmp(h + pos + 1, needle.data() + 1, k - 2))
+        return true;
+    }
+  }
+
+  return i < n && haystack.substr(i).find(needle) != string_view::npos;
+}
+#endif
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HAS_AVX2_DISPATCH
+
+/*
+ * Checks whether or not `needle` occurs in `haystack` with AVX2.
+ *
+ * @param haystack The bytes to search.
+ * @param needle The bytes to look for, at least one.
+ * @return Whether or not `needle` occurs in `haystack`.
+ */
+__attribute__((target("avx2"))) bool
+contains_avx2(string_view haystack, string_view needle) {
+  const char *h = haystack.data();
+  size_t n = haystack.size(), k = needle.size(), i = 0;
+
+  __m256i first = _mm256_set1_epi8(needle[0]),
+          last = _mm256_set1_epi8(needle[k - 1]);
+
+  for (; i + k - 1 + 32 <= n; i += 32) {
+    __m256i head =
+              _mm256_loadu_si256(reinterpret_cast<const __m256i *>(h + i)),
+            tail = _mm256_loadu_si256(
+              reinterpret_cast<const __m256i *>(h + i + k - 1)
+            );
+
+    uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(
+      _mm256_cmpeq_epi8(head, first), _mm256_cmpeq_epi8(tail, last)
+    ));
+
+    for (; mask; mask &= mask - 1) {
+      size_t pos = i + __builtin_ctz(mask);
+      if (k <= 2 || !memcmp(h + pos + 1, needle.data() + 1, k - 2))
+        return true;
+    }
+  }
+
+  return i < n && haystack.substr(i).find(needle) != string_view::npos;
+}
+#endif
+
+/*
+ * Checks whether or not `needle` occurs in `haystack`.
+ *
+ * Uses AVX2 when the CPU supports it, SSE2 otherwise, and
+ * `string_view::find` on other architectures.
+ *
+ * @param haystack The bytes to search.
+ * @param needle The bytes to look for.
+ * @return Whether or not `needle` occurs in `haystack`.
+ */
+bool contains(string_view haystack, string_view needle) {
+  if (needle.empty())
+    return true;
+
+  if (needle.size() > haystack.size())
+    return false;
+
+#if defined(HAS_AVX2_DISPATCH)
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+
+  if (avx2)
+    return contains_avx2(haystack, needle);
+#endif
+
+#if defined(__SSE2__)
+  return contains_sse2(haystack, needle);
+#else
+  return haystack.find(needle) != string_view::npos;
+#endif
+}
+
+/*
+ * The fixed-size header at the start of a database.
+ *
+ * The chunk table (sorted by chunk id), version table and chunk id
+ * area follow the header, then the stored chunk bytes, then the search
+ * index.
+ */
+struct DatabaseHeader {
+  char magic[8];
+  int32_t format;
+  uint32_t reserved;
+  uint64_t generation;
+  uint64_t chunk_count, chunk_table;
+  uint64_t version_count, version_table;
+  uint64_t index_offset, index_size;
+};
+
+/*
+ * A chunk table entry: where a chunk's stored bytes are and how to
+ * decode them.
+ */
+struct ChunkEntry {
+  uint64_t id, offset, size, stored;
+  uint32_t codec, reserved;
+};
+
+/*
+ * The size, modification time (in nanoseconds) and inode of the file a
+ * version was captured from. An inode of 0 means the stat is unknown.
+ */
+struct FileStat {
+  uint64_t size;
+  int64_t mtime;
+  uint64_t inode;
+};
+
+/*
+ * Convert the result of `stat` or `fstat`.
+ *
+ * @param info The file's status.
+ * @return The file's stat.
+ */
+FileStat get_file_stat(const struct stat &info) {
+#if defined(__APPLE__)
+  const struct timespec &time = info.st_mtimespec;
+#else
+  const struct timespec &time = info.st_mtim;
+#endif
+
+  int64_t mtime = int64_t(time.tv_sec) * 1000000000 + time.tv_nsec;
+  return FileStat{uint64_t(info.st_size), mtime, uint64_t(info.st_ino)};
+}
+
+/*
+ * Get the stat of a file.
+ *
+ * @param path The file's name.
+ * @return The file's stat, or an unknown stat if it does not exist.
+ */
+FileStat get_file_stat(const string &path) {
+  struct stat info;
+  return stat(path.c_str(), &info) == 0 ? get_file_stat(info) : FileStat{};
+}
+
+/*
+ * Check whether or not a file is unchanged, going by its stat.
+ *
+ * @param recorded The stat recorded with a version, possibly unknown.
+ * @param current The file's current stat.
+ * @return Whether or not the stats are known and equal.
+ */
+bool same_stat(const FileStat &recorded, const FileStat &current) {
+  return recorded.inode != 0 && recorded.inode == current.inode &&
+         recorded.size == current.size && recorded.mtime == current.mtime;
+}
+
+/*
+ * Check whether or not a stat is old enough to be recorded.
+ *
+ * @param stat The stat.
+ * @return Whether or not the file was last changed at least
+ * `STAT_SETTLE_NS` ago.
+ */
+bool is_settled(const FileStat &stat) {
+  timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  int64_t time = int64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+  return stat.inode != 0 && stat.mtime <= time - STAT_SETTLE_NS;
+}
+
+/*
+ * Flush a file or directory to disk.
+ *
+ * @param path The file's name.
+ * @return Whether or not the file reached the disk.
+ */
+bool sync_path(const string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+
+  if (fd == -1)
+    return false;
+
+  bool ok = fsync(fd) == 0;
+  close(fd);
+
+  return ok;
+}
+
+/*
+ * Flush the directory holding a file to disk, so that a rename into it
+ * is durable.
+ *
+ * @param path The file's name.
+ * @return Whether or not the directory reached the disk.
+ */
+bool sync_parent(const string &path) {
+  string dir = filesystem::path(path).parent_path().string();
+  return sync_path(dir.empty() ? "." : dir);
+}
+
+/*
+ * Read up to `size` bytes at an offset of a file.
+ *
+ * @param fd The file.
+ * @param out The output buffer.
+ * @param size The number of bytes to read.
+ * @param offset The offset to read at.
+ * @return The number of bytes read, short only at the end of the file
+ * or on error.
+ */
+size_t pread_all(int fd, char *out, size_t size, off_t offset) {
+  size_t done = 0;
+
+  while (done < size) {
+    ssize_t n = pread(fd, out + done, size - done, offset + done);
+
+    if (n < 0 && errno == EINTR)
+      continue;
+
+    if (n <= 0)
+      break;
+
+    done += n;
+  }
+
+  return done;
+}
+
+/*
+ * Write bytes at an offset of a file.
+ *
+ * @param fd The file.
+ * @param data The bytes.
+ * @param size The number of bytes.
+ * @param offset The offset to write at.
+ * @return Whether or not every byte was written.
+ */
+bool pwrite_all(int fd, const char *data, size_t size, off_t offset) {
+  size_t done = 0;
+
+  while (done < size) {
+    ssize_t n = pwrite(fd, data + done, size - done, offset + done);
+
+    if (n < 0 && errno == EINTR)
+      continue;
+
+    if (n <= 0)
+      return false;
+
+    done += n;
+  }
+
+  return true;
+}
+
+/*
+ * A version table entry, listed from the currently loaded version to
+ * the oldest. `offset` and `length` locate the version's chunk ids.
+ */
+struct VersionEntry {
+  int32_t version, reserved;
+  uint64_t offset, length, hash;
+  FileStat stat;
+};
+
+/*
+ * A read-only memory mapping of a regular file.
+ */
+class MappedFile {
+  public:
+    const char *data;
+    size_t size;
+
+    MappedFile(const string &file) {
+      this->data = nullptr;
+      this->size = 0;
+      this->fd = open(file.c_str(), O_RDONLY);
+
+      struct stat info;
+
+      if (fd < 0 || fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        release();
+        return;
+      }
+
+      size = info.st_size;
+
+      if (size == 0)
+        return;
+
+      void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+      if (addr == MAP_FAILED) {
+        release();
+        return;
+      }
+
+      data = static_cast<const char *>(addr);
+    }
+
+    /*
+     * Whether or not the file could be mapped.
+     */
+    bool is_open() {
+      return fd >= 0;
+    }
+
+    ~MappedFile() {
+      release();
+    }
+
+  private:
+    int fd;
+
+    void release() {
+      if (data != nullptr)
+        munmap(const_cast<char *>(data), size);
+
+      if (fd >= 0)
+        close(fd);
+
+      data = nullptr;
+      size = 0;
+      fd = -1;
+    }
+};
+
+/*
+ * The chunk table of a mapped database, sorted by chunk id.
+ *
+ * Entries are looked up by binary search and checked as they are
+ * read, so opening a database does not touch the table.
+ */
+struct ChunkTable {
+  const char *base;
+  size_t size;
+  const char *entries;
+  uint64_t count;
+
+  /*
+   * Find the entry of a chunk.
+   *
+   * => Stops the program if the entry is out of range.
+   *
+   * @param id The chunk's id.
+   * @param entry Set to the chunk's entry (output).
+   * @return Whether or not the table holds the chunk.
+   */
+  bool find(uint64_t id, ChunkEntry &entry) const {
+    uint64_t low = 0, high = count;
+
+    while (low < high) {
+      uint64_t mid = low + (high - low) / 2, key;
+      memcpy(&key, entries + mid * sizeof(ChunkEntry), sizeof(key));
+
+      if (key < id)
+        low = mid + 1;
+      else
+        high = mid;
+    }
+
+    if (low == count)
+      return false;
+
+    memcpy(&entry, entries + low * sizeof(ChunkEntry), sizeof(entry));
+
+    if (entry.id != id)
+      return false;
+
+    bool valid = entry.codec == CODEC_LZ ||
+                 (entry.codec == CODEC_RAW && entry.stored == entry.size);
+
+    if (entry.offset > size || entry.stored > size - entry.offset || !valid)
+      fail("A chunk table entry is out of range");
+
+    return true;
+  }
+
+  /*
+   * Get the stored bytes of a chunk.
+   *
+   * @param entry The chunk's entry.
+   * @return The chunk's stored bytes.
+   */
+  string_view block(const ChunkEntry &entry) const {
+    return string_view(base + entry.offset, entry.stored);
+  }
+};
+
+/*
+ * The ids of a version's chunks.
+ *
+ * The ids are either owned, or viewed in place in a mapped database and
+ * read as they are needed.
+ */
+class ChunkIds {
+  public:
+    /*
+     * Default constructor.
+     *
+     * @param ids The ids to own.
+     */
+    ChunkIds(vector<uint64_t> ids = {}) {
+      this->owned = move(ids);
+      this->mapped = nullptr;
+      this->count = owned.size();
+    }
+
+    /*
+     * View ids in a mapped database.
+     *
+     * @param mapped The first id's bytes.
+     * @param count The number of ids.
+     */
+    ChunkIds(const char *mapped, size_t count) {
+      this->mapped = mapped;
+      this->count = count;
+    }
+
+    /*
+     * Get the number of ids.
+     *
+     * @return The number of ids.
+     */
+    size_t size() const {
+      return count;
+    }
+
+    /*
+     * Get an id.
+     *
+     * @param i The id's position.
+     * @return The id.
+     */
+    uint64_t operator[](size_t i) const {
+      if (mapped == nullptr)
+        return owned[i];
+
+      uint64_t id;
+      memcpy(&id, mapped + i * sizeof(id), sizeof(id));
+      return id;
+    }
+
+    /*
+     * Get the bytes of the ids, in database order.
+     *
+     * @return The ids' bytes.
+     */
+    string_view bytes() const {
+      const char *data = mapped != nullptr
+                           ? mapped
+                           : reinterpret_cast<const char *>(owned.data());
+      return string_view(data, count * sizeof(uint64_t));
+    }
+
+    /*
+     * Copy the ids.
+     *
+     * @return The ids.
+     */
+    vector<uint64_t> copy() const {
+      vector<uint64_t> ids(count);
+      string_view data = bytes();
+      if (count > 0)
+        memcpy(ids.data(), data.data(), data.size());
+      return ids;
+    }
+
+    /*
+     * Check whether or not the ids are viewed in a mapping.
+     *
+     * @param base The start of the mapping.
+     * @param size The size of the mapping.
+     * @return Whether or not the ids lie in the mapping.
+     */
+    bool is_in(const char *base, size_t size) const {
+      uintptr_t at = uintptr_t(mapped);
+      return mapped != nullptr && at >= uintptr_t(base) &&
+             at < uintptr_t(base) + size;
+    }
+
+  private:
+    vector<uint64_t> owned;
+    const char *mapped;
+    size_t count;
+};
+
+/*
+ * A content-addressed store of reference counted chunks.
+ *
+ * Contents are split into content-defined chunks, and each distinct
+ * chunk is stored once under its hash, so similar contents share most
+ * of their storage.
+ */
+class ChunkStore {
+  private:
+    /*
+     * A stored chunk, either resident in `data` or, when `block` is
+     * set, still encoded with `codec` in the mapped database.
+     */
+    struct Chunk {
+      string data;
+      string_view block;
+      uint8_t codec;
+      size_t size;
+      int refs;
+    };
+
+    unordered_map<uint64_t, Chunk> chunks;
+    ChunkTable table;
+
+    /*
+     * Append the bytes of a chunk to a buffer.
+     *
+     * @param chunk The chunk.
+     * @param out The output buffer.
+     */
+    static void append(const Chunk &chunk, string &out) {
+      if (chunk.block.data() == nullptr)
+        out += chunk.data;
+      else if (chunk.codec == CODEC_RAW)
+        out += chunk.block;
+      else {
+        size_t at = out.size();
+        out.resize(at + chunk.size);
+        if (!lz_decompress(chunk.block, &out[at], chunk.size))
+          fail("A stored chunk could not be decoded");
+      }
+    }
+
+    /*
+     * Find a chunk, resident or in the mapped chunk table.
+     *
+     * @param id The chunk's id.
+     * @param found Filled in for a chunk of the table (output).
+     * @return The chunk, or `nullptr` if it is not stored.
+     */
+    const Chunk *lookup(uint64_t id, Chunk &found) const {
+      auto it = chunks.find(id);
+
+      if (it != chunks.end())
+        return &it->second;
+
+      ChunkEntry entry;
+
+      if (!table.find(id, entry))
+        return nullptr;
+
+      found = Chunk{string(), table.block(entry), uint8_t(entry.codec),
+                    entry.size, 0};
+      return &found;
+    }
+
+    /*
+     * Find a chunk that a version refers to.
+     *
+     * => Stops the program if the chunk is not stored.
+     *
+     * @param id The chunk's id.
+     * @param found Filled in for a chunk of the table (output).
+     * @return The chunk.
+     */
+    const Chunk &require(uint64_t id, Chunk &found) const {
+      const Chunk *chunk = lookup(id, found);
+
+      if (chunk == nullptr)
+        fail("A version refers to a missing chunk");
+
+      return *chunk;
+    }
+
+    /*
+     * Add a reference to a chunk, storing it if it is new.
+     *
+     * => Chunks of the mapped table are shared without a reference.
+     *
+     * @param data The chunk's bytes.
+     * @param fresh Set when the chunk was not stored yet (output).
+     * @return The chunk's id.
+     */
+    uint64_t put_chunk(string_view data, bool &fresh) {
+      fresh = false;
+
+      for (uint64_t id = chunk_hash(data);; ++id) {
+        auto it = chunks.find(id);
+
+        if (it != chunks.end()) {
+          if (it->second.data == data) {
+            ++it->second.refs;
+            return id;
+          }
+
+          continue;
+        }
+
+        ChunkEntry entry;
+
+        if (table.find(id, entry)) {
+          if (entry.size == data.size() && chunk(id) == data)
+            return id;
+
+          continue;
+        }
+
+        chunks.emplace(id, Chunk{string(data), {}, CODEC_RAW, data.size(), 1});
+        fresh = true;
+        return id;
+      }
+    }
+
+  public:
+    /*
+     * Default constructor.
+     */
+    ChunkStore() {
+      this->table = ChunkTable{nullptr, 0, nullptr, 0};
+    }
+
+    /*
+     * Store a content.
+     *
+     * @param content The content.
+     * @param fresh If given, set to whether or not each chunk was newly
+     * stored (output).
+     * @return The ids of the content's chunks, in order.
+     */
+    vector<uint64_t> put(
+      const string &content, vector<char> *fresh = nullptr
+    ) {
+      vector<uint64_t> ids;
+
+      for (size_t pos = 0; pos < content.size();) {
+        size_t length = next_cut(content.data() + pos, content.size() - pos);
+        bool added;
+        string_view data = string_view(content).substr(pos, length);
+        ids.push_back(put_chunk(data, added));
+        if (fresh)
+          fresh->push_back(added);
+        pos += length;
+      }
+
+      return ids;
+    }
+
+    /*
+     * Get the bytes of a chunk.
+     *
+     * @param id The chunk's id.
+     * @return The chunk's bytes.
+     */
+    string chunk(uint64_t id) const {
+      Chunk found;
+      string data;
+      append(require(id, found), data);
+      return data;
+    }
+
+    /*
+     * Check whether or not a chunk is stored.
+     *
+     * @param id The chunk's id.
+     * @return Whether or not the chunk is stored.
+     */
+    bool has(uint64_t id) const {
+      Chunk found;
+      return lookup(id, found) != nullptr;
+    }
+
+    /*
+     * Get the size of a chunk.
+     *
+     * @param id The chunk's id.
+     * @return The chunk's size.
+     */
+    size_t length(uint64_t id) const {
+      Chunk found;
+      return require(id, found).size;
+    }
+
+    /*
+     * Store a chunk under a known id, without references.
+     *
+     * => Does nothing if the chunk is already stored.
+     *
+     * @param id The chunk's id.
+     * @param data The chunk's bytes.
+     */
+    void restore(uint64_t id, string data) {
+      if (has(id))
+        return;
+
+      size_t size = data.size();
+      chunks[id] = Chunk{move(data), {}, CODEC_RAW, size, 0};
+    }
+
+    /*
+     * Check whether or not a chunk is held in memory rather than in the
+     * mapped chunk table.
+     *
+     * @param id The chunk's id.
+     * @return Whether or not the chunk is resident.
+     */
+    bool is_resident(uint64_t id) const {
+      return chunks.count(id) != 0;
+    }
+
+    /*
+     * Read chunks from the chunk table of a mapped database.
+     *
+     * @param table The chunk table.
+     */
+    void attach(const ChunkTable &table) {
+      this->table = table;
+    }
+
+    /*
+     * Move onto the chunk table of a newly written database.
+     *
+     * => Resident chunks the new table holds are freed, and their bytes
+     * are read back from it when needed. Chunks that `kept` refers to
+     * and only the current table holds are decoded into memory first,
+     * so that the current mapping can go.
+     *
+     * @param table The new chunk table.
+     * @param kept The ids of the versions the new database does not
+     * hold.
+     */
+    void remap(const ChunkTable &table, const vector<const ChunkIds *> &kept) {
+      unordered_map<uint64_t, Chunk> moved;
+      ChunkEntry entry;
+
+      for (const ChunkIds *ids : kept) {
+        for (size_t i = 0; i < ids->size(); ++i) {
+          uint64_t id = (*ids)[i];
+
+          if (chunks.count(id) || table.find(id, entry))
+            continue;
+
+          auto it = moved.find(id);
+
+          if (it == moved.end()) {
+            string data = chunk(id);
+            size_t size = data.size();
+            it = moved.emplace(id, Chunk{move(data), {}, CODEC_RAW, size, 0})
+                   .first;
+          }
+
+          ++it->second.refs;
+        }
+      }
+
+      for (auto it = chunks.begin(); it != chunks.end();)
+        it = table.find(it->first, entry) ? chunks.erase(it) : next(it);
+
+      chunks.merge(moved);
+      this->table = table;
+    }
+
+    /*
+     * Rebuild a content from its chunks.
+     *
+     * => Does not modify the store, so it may run on several threads.
+     * Stops the program if a chunk is not stored.
+     *
+     * @param ids The ids of the content's chunks.
+     * @return The content.
+     */
+    string get(const ChunkIds &ids) const {
+      size_t size = 0;
+      Chunk found;
+
+      for (size_t i = 0; i < ids.size(); ++i)
+        size += require(ids[i], found).size;
+
+      string content;
+      content.reserve(size);
+
+      for (size_t i = 0; i < ids.size(); ++i)
+        append(require(ids[i], found), content);
+
+      return content;
+    }
+
+    /*
+     * Add a reference to already stored chunks.
+     *
+     * @param ids The chunks' ids.
+     */
+    void retain(const ChunkIds &ids) {
+      for (size_t i = 0; i < ids.size(); ++i) {
+        auto it = chunks.find(ids[i]);
+        if (it != chunks.end())
+          ++it->second.refs;
+      }
+    }
+
+    /*
+     * Drop a reference to chunks, freeing resident ones no longer used.
+     *
+     * @param ids The chunks' ids.
+     */
+    void release(const ChunkIds &ids) {
+      for (size_t i = 0; i < ids.size(); ++i) {
+        auto it = chunks.find(ids[i]);
+        if (it != chunks.end() && --it->second.refs <= 0)
+          chunks.erase(it);
+      }
+    }
+
+    /*
+     * Write the stored bytes of chunks to a stream.
+     *
+     * => Resident chunks are compressed unless that does not make them
+     * smaller, and mapped chunks are copied as they are.
+     *
+     * @param stream The output stream.
+     * @param ids The ids of the chunks, sorted and without duplicates.
+     * @param entries Set to each chunk's table entry, sorted by id
+     * (output).
+     */
+    void save(
+      ostream &stream, const vector<uint64_t> &ids,
+      vector<ChunkEntry> &entries
+    ) {
+      for (uint64_t id : ids) {
+        Chunk found;
+        const Chunk &chunk = require(id, found);
+
+        string packed;
+        string_view block = chunk.block;
+        uint8_t codec = chunk.codec;
+
+        if (block.data() == nullptr) {
+          packed = lz_compress(chunk.data);
+          codec = packed.size() < chunk.size ? CODEC_LZ : CODEC_RAW;
+          block = codec == CODEC_LZ ? string_view(packed) : chunk.data;
+        }
+
+        entries.push_back(ChunkEntry{
+          id, uint64_t(stream.tellp()), chunk.size, block.size(), codec, 0
+        });
+
+        stream.write(block.data(), block.size());
+      }
+    }
+};
+
+/*
+ * An inverted index from the trigrams of version contents to the
+ * versions containing them.
+ *
+ * Any version containing a keyword contains all of the keyword's
+ * trigrams, so intersecting their posting lists narrows a search down
+ * to a few candidate versions.
+ */
+class TrigramIndex {
+  private:
+    unordered_map<uint32_t, vector<int>> postings;
+    string_view pending;
+
+    /*
+     * Get the distinct trigrams of some bytes.
+     *
+     * @param content The bytes.
+     * @return Each trigram packed into 24 bits, in order of first
+     * occurrence.
+     */
+    static vector<uint32_t> keys(string_view content) {
+      vector<uint32_t> result;
+
+      if (content.size() < 3)
+        return result;
+
+      vector<uint64_t> seen(1 << 18);
+      uint32_t key = (unsigned char)content[0] << 8 | (unsigned char)content[1];
+
+      for (size_t i = 2; i < content.size(); ++i) {
+        key = (key << 8 | (unsigned char)content[i]) & 0xffffff;
+
+        uint64_t bit = 1ULL << (key & 63);
+
+        if (!(seen[key >> 6] & bit)) {
+          seen[key >> 6] |= bit;
+          result.push_back(key);
+        }
+      }
+
+      return result;
+    }
+
+  public:
+    /*
+     * Parse a saved index attached with `attach`, unless it was already
+     * used.
+     */
+    void ensure() {
+      if (pending.data() == nullptr)
+        return;
+
+      string_view section = pending;
+      pending = string_view();
+
+      size_t pos = 0;
+
+      if (section.size() < sizeof(size_t))
+        fail("The search index is cut short");
+
+      size_t count = get_value<size_t>(section, pos);
+
+      for (size_t i = 0; i < count; ++i) {
+        if (section.size() - pos < sizeof(uint32_t) + sizeof(size_t))
+          fail("The search index is cut short");
+
+        uint32_t key = get_value<uint32_t>(section, pos);
+        size_t size = get_value<size_t>(section, pos);
+
+        if (size > (section.size() - pos) / sizeof(int))
+          fail("The search index is cut short");
+
+        vector<int> &versions = postings[key];
+        versions.resize(size);
+        memcpy(versions.data(), section.data() + pos, size * sizeof(int));
+        pos += size * sizeof(int);
+      }
+    }
+
+    /*
+     * Index a version.
+     *
+     * @param version The version.
+     * @param content The version's content.
+     */
+    void add(int version, string_view content) {
+      ensure();
+
+      for (uint32_t key : keys(content)) {
+        vector<int> &versions = postings[key];
+        versions.insert(
+          upper_bound(versions.begin(), versions.end(), version), version
+        );
+      }
+    }
+
+    /*
+     * Remove a version from the index.
+     *
+     * @param version The version.
+     * @param content The version's content.
+     */
+    void remove(int version, string_view content) {
+      ensure();
+
+      for (uint32_t key : keys(content)) {
+        auto it = postings.find(key);
+
+        if (it == postings.end())
+          continue;
+
+        vector<int> &versions = it->second;
+        auto pos = lower_bound(versions.begin(), versions.end(), version);
+
+        if (pos != versions.end() && *pos == version)
+          versions.erase(pos);
+
+        if (versions.empty())
+          postings.erase(it);
+      }
+    }
+
+    /*
+     * Find the versions that may contain a keyword.
+     *
+     * @param keyword The keyword.
+     * @param versions Set to the candidate versions, in increasing order.
+     * @return Whether or not the keyword is long enough to narrow the
+     * search down.
+     */
+    bool candidates(string_view keyword, vector<int> &versions) {
+      ensure();
+      versions.clear();
+
+      if (keyword.size() < 3)
+        return false;
+
+      vector<const vector<int> *> lists;
+
+      for (uint32_t key : keys(keyword)) {
+        auto it = postings.find(key);
+
+        if (it == postings.end())
+          return true;
+
+        lists.push_back(&it->second);
+      }
+
+      sort(lists.begin(), lists.end(), [](auto *a, auto *b) {
+        return a->size() < b->size();
+      });
+
+      versions = *lists[0];
+
+      for (size_t i = 1; i < lists.size() && !versions.empty(); ++i) {
+        vector<int> both;
+        set_intersection(
+          versions.begin(), versions.end(), lists[i]->begin(), lists[i]->end(),
+          back_inserter(both)
+        );
+        versions.swap(both);
+      }
+
+      return true;
+    }
+
+    /*
+     * Write the index to a stream.
+     *
+     * => Writes the number of trigrams, followed by each trigram and its
+     * posting list's length and versions.
+     *
+     * @param stream The output stream.
+     */
+    void save(ostream &stream) {
+      if (pending.data() != nullptr) {
+        stream.write(pending.data(), pending.size());
+        return;
+      }
+
+      size_t count = postings.size();
+      stream.write(reinterpret_cast<char *>(&count), sizeof(count));
+
+      for (auto &entry : postings) {
+        uint32_t key = entry.first;
+        size_t size = entry.second.size();
+
+        stream.write(reinterpret_cast<char *>(&key), sizeof(key));
+        stream.write(reinterpret_cast<char *>(&size), sizeof(size));
+        stream.write(
+          reinterpret_cast<const char *>(entry.second.data()),
+          size * sizeof(int)
+        );
+      }
+    }
+
+    /*
+     * Use an index written by `save` that stays in memory, such as a
+     * mapped database, parsing it only when it is first needed.
+     *
+     * @param section The saved index.
+     */
+    void attach(string_view section) {
+      postings.clear();
+      pending = section;
+    }
+};
+
+/*
+ * The lines of a content, split the way `getline` splits them: where
+ * each one starts and the XXH64 hash of its bytes.
+ *
+ * The index does not hold the content, only offsets into it.
+ */
+class LineIndex {
+  public:
+    vector<size_t> offsets;
+    vector<uint64_t> hashes;
+
+    /*
+     * Index the lines of a content.
+     *
+     * @param content The content.
+     */
+    LineIndex(string_view content) {
+      offsets.push_back(0);
+
+      for (size_t pos = 0; pos < content.size();) {
+        const void *end = memchr(&content[pos], '\n', content.size() - pos);
+        size_t length = end ? static_cast<const char *>(end) - &content[pos]
+                            : content.size() - pos;
+
+        hashes.push_back(xxh64(content.substr(pos, length)));
+        pos += end ? length + 1 : length;
+        offsets.push_back(pos);
+      }
+    }
+
+    /*
+     * Get the number of lines.
+     *
+     * @return The number of lines.
+     */
+    size_t count() const {
+      return hashes.size();
+    }
+
+    /*
+     * Get a line of the indexed content.
+     *
+     * @param content The indexed content.
+     * @param line The line's index.
+     * @return The line, without its line break.
+     */
+    string_view line(string_view content, size_t line) const {
+      size_t start = offsets[line], end = offsets[line + 1];
+
+      if (end > start && content[end - 1] == '\n')
+        --end;
+
+      return content.substr(start, end - start);
+    }
+
+    /*
+     * Get the number of bytes this index takes.
+     *
+     * @return The number of bytes.
+     */
+    size_t footprint() const {
+      return offsets.size() * sizeof(size_t) + hashes.size() * sizeof(uint64_t);
+    }
+};
+
+/*
+ * A longest common subsequence of the lines of two contents, found with
+ * Myers' linear space diff algorithm.
+ *
+ * Lines are compared by hash first, and lines whose hash does not occur
+ * in the other content are left out up front, since they cannot be
+ * part of the subsequence.
+ */
+class LineDiff {
+  private:
+    string_view left, right;
+    const LineIndex &left_lines, &right_lines;
+    vector<long> left_kept, right_kept;
+    vector<pair<size_t, size_t>> matches;
+
+    /*
+     * Check whether or not two kept lines are equal.
+     *
+     * @param i The left line's position among the kept left lines.
+     * @param j The right line's position among the kept right lines.
+     * @return Whether or not the lines are equal.
+     */
+    bool same(long i, long j) const {
+      long a = left_kept[i], b = right_kept[j];
+      return left_lines.hashes[a] == right_lines.hashes[b] &&
+             left_lines.line(left, a) == right_lines.line(right, b);
+    }
+
+    /*
+     * Record a match between two kept lines.
+     *
+     * @param i The left line's position among the kept left lines.
+     * @param j The right line's position among the kept right lines.
+     */
+    void match(long i, long j) {
+      matches.emplace_back(left_kept[i], right_kept[j]);
+    }
+
+    /*
+     * Find the common lines of two ranges of kept lines, in order.
+     *
+     * => Splits the ranges at the middle snake of their shortest edit
+     * script, and recurses on either side of it.
+     *
+     * @param a0 The start of the left range.
+     * @param a1 The end of the left range.
+     * @param b0 The start of the right range.
+     * @param b1 The end of the right range.
+     */
+    void split(long a0, long a1, long b0, long b1) {
+      while (a0 < a1 && b0 < b1 && same(a0, b0))
+        match(a0++, b0++);
+
+      long tail = 0;
+
+      while (a0 < a1 && b0 < b1 && same(a1 - 1, b1 - 1))
+        --a1, --b1, ++tail;
+
+      if (a0 < a1 && b0 < b1) {
+        long n = a1 - a0, m = b1 - b0, delta = n - m;
+        long limit = (n + m + 1) / 2, off = limit + 1;
+        vector<long> forward(2 * off + 1), backward(2 * off + 1);
+        long x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+        bool found = false;
+
+        for (long d = 0; d <= limit && !found; ++d) {
+          for (long k = -d; k <= d && !found; k += 2) {
+            long x = k == -d || (k != d && forward[off + k - 1] <
+                                             forward[off + k + 1])
+                       ? forward[off + k + 1]
+                       : forward[off + k - 1] + 1;
+            long y = x - k, sx = x, sy = y, r = delta - k;
+
+            while (x < n && y < m && same(a0 + x, b0 + y))
+              ++x, ++y;
+
+            forward[off + k] = x;
+
+            if (delta % 2 != 0 && r >= 1 - d && r <= d - 1 &&
+                x + backward[off + r] >= n) {
+              x0 = sx, y0 = sy, x1 = x, y1 = y;
+              found = true;
+            }
+          }
+
+          for (long k = -d; k <= d && !found; k += 2) {
+            long x = k == -d || (k != d && backward[off + k - 1] <
+                                             backward[off + k + 1])
+                       ? backward[off + k + 1]
+                       : backward[off + k - 1] + 1;
+            long y = x - k, sx = x, sy = y, r = delta - k;
+
+            while (x < n && y < m && same(a1 - 1 - x, b1 - 1 - y))
+              ++x, ++y;
+
+            backward[off + k] = x;
+
+            if (delta % 2 == 0 && r >= -d && r <= d &&
+                x + forward[off + r] >= n) {
+              x0 = n - x, y0 = m - y, x1 = n - sx, y1 = m - sy;
+              found = true;
+            }
+          }
+        }
+
+        split(a0, a0 + x0, b0, b0 + y0);
+
+        for (long i = 0; i < x1 - x0; ++i)
+          match(a0 + x0 + i, b0 + y0 + i);
+
+        split(a0 + x1, a1, b0 + y1, b1);
+      }
+
+      for (long i = 0; i < tail; ++i)
+        match(a1 + i, b1 + i);
+    }
+
+  public:
+    /*
+     * Diff the lines of two contents.
+     *
+     * @param left The left content.
+     * @param left_lines The left content's line index.
+     * @param right The right content.
+     * @param right_lines The right content's line index.
+     */
+    LineDiff(
+      string_view left, const LineIndex &left_lines, string_view right,
+      const LineIndex &right_lines
+    )
+      : left_lines(left_lines), right_lines(right_lines) {
+      this->left = left;
+      this->right = right;
+
+      unordered_map<uint64_t, char> seen;
+
+      for (uint64_t hash : left_lines.hashes)
+        seen[hash] |= 1;
+
+      for (uint64_t hash : right_lines.hashes)
+        seen[hash] |= 2;
+
+      for (size_t i = 0; i < left_lines.count(); ++i)
+        if (seen[left_lines.hashes[i]] == 3)
+          left_kept.push_back(i);
+
+      for (size_t i = 0; i < right_lines.count(); ++i)
+        if (seen[right_lines.hashes[i]] == 3)
+          right_kept.push_back(i);
+
+      split(0, left_kept.size(), 0, right_kept.size());
+    }
+
+    /*
+     * Get the common lines.
+     *
+     * @return The index of each common line in the left and the right
+     * content, in order.
+     */
+    const vector<pair<size_t, size_t>> &get_matches() {
+      return matches;
+    }
+};
+
+/*
+ * An Aho-Corasick automaton matching many keywords in one pass.
+ *
+ * The keywords form a trie whose missing transitions are filled in from
+ * each state's failure link, so scanning a content takes one table
+ * lookup per byte however many keywords there are.
+ */
+class KeywordMatcher {
+  private:
+    vector<array<int, 256>> next;
+    vector<vector<int>> outputs;
+    size_t keyword_count;
+
+    /*
+     * Add an empty state.
+     *
+     * @return The new state.
+     */
+    int add_state() {
+      array<int, 256> transitions;
+      transitions.fill(-1);
+
+      next.push_back(transitions);
+      outputs.emplace_back();
+
+      return next.size() - 1;
+    }
+
+  public:
+    /*
+     * Build the automaton.
+     *
+     * @param keywords The keywords to match.
+     */
+    KeywordMatcher(const vector<string> &keywords) {
+      this->keyword_count = keywords.size();
+
+      add_state();
+
+      for (size_t k = 0; k < keywords.size(); ++k) {
+        int state = 0;
+
+        for (unsigned char c : keywords[k]) {
+          if (next[state][c] == -1) {
+            int child = add_state();
+            next[state][c] = child;
+          }
+          state = next[state][c];
+        }
+
+        outputs[state].push_back(k);
+      }
+
+      vector<int> fail(next.size(), 0);
+      deque<int> queue;
+
+      for (int c = 0; c < 256; ++c) {
+        if (next[0][c] == -1)
+          next[0][c] = 0;
+        else
+          queue.push_back(next[0][c]);
+      }
+
+      while (!queue.empty()) {
+        int state = queue.front();
+        queue.pop_front();
+
+        for (int c = 0; c < 256; ++c) {
+          int child = next[state][c];
+
+          if (child == -1) {
+            next[state][c] = next[fail[state]][c];
+            continue;
+          }
+
+          fail[child] = next[fail[state]][c];
+          outputs[child].insert(
+            outputs[child].end(), outputs[fail[child]].begin(),
+            outputs[fail[child]].end()
+          );
+          queue.push_back(child);
+        }
+      }
+    }
+
+    /*
+     * Find which keywords occur in a content.
+     *
+     * @param content The content to scan.
+     * @return For each keyword, whether or not it occurs in `content`.
+     */
+    vector<char> match(string_view content) const {
+      vector<char> found(keyword_count);
+      size_t remaining = keyword_count;
+
+      int state = 0;
+
+      for (unsigned char c : content) {
+        state = next[state][c];
+
+        for (int k : outputs[state]) {
+          if (found[k])
+            continue;
+
+          found[k] = true;
+
+          if (--remaining == 0)
+            return found;
+        }
+      }
+
+      return found;
+    }
+};
+
+/*
+ * An append-only log of framed records.
+ *
+ * Each record is written as its 64-bit length, its XXH64 checksum and
+ * its bytes, and is flushed to disk before `append` returns. A record cut
+ * short by a crash fails its checksum and is dropped on the next read.
+ */
+class Journal {
+  private:
+    int fd;
+    uint64_t size;
+
+    /*
+     * Cut a failed append back off the journal. If that fails too, stop
+     * appending, since later records would follow a torn one.
+     */
+    void rollback() {
+      if (ftruncate(fd, size) != 0) {
+        close(fd);
+        fd = -1;
+      }
+    }
+
+  public:
+    /*
+     * Open a journal for appending, creating it if needed.
+     *
+     * @param path The journal's filename.
+     */
+    Journal(const string &path) {
+      this->fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+      this->size = 0;
+
+      struct stat info;
+
+      if (fd != -1 && fstat(fd, &info) == 0)
+        this->size = info.st_size;
+    }
+
+    /*
+     * Get the number of bytes in this journal.
+     *
+     * @return The journal's size.
+     */
+    uint64_t get_size() {
+      return size;
+    }
+
+    /*
+     * Durably append a record.
+     *
+     * => A record that fails to reach the disk is cut back off the
+     * journal, so the next one still follows the last intact record.
+     *
+     * @param record The record's bytes.
+     * @return Whether or not the record reached the disk.
+     */
+    bool append(const string &record) {
+      return append(vector<string_view>{record});
+    }
+
+    /*
+     * Durably append a record given in pieces.
+     *
+     * => The pieces are written straight from where they are, so large
+     * records are never copied into one buffer.
+     *
+     * @param pieces The record's bytes, in order.
+     * @return Whether or not the record reached the disk.
+     */
+    bool append(const vector<string_view> &pieces) {
+      if (fd == -1)
+        return false;
+
+      StreamHasher hasher;
+      uint64_t length = 0;
+
+      for (string_view piece : pieces) {
+        hasher.update(piece);
+        length += piece.size();
+      }
+
+      string frame;
+      put_value(frame, length);
+      put_value(frame, hasher.digest());
+
+      vector<iovec> parts = {{&frame[0], frame.size()}};
+
+      for (string_view piece : pieces)
+        if (!piece.empty())
+          parts.push_back({const_cast<char *>(piece.data()), piece.size()});
+
+      iovec *part = parts.data();
+      size_t count = parts.size();
+
+      while (count > 0) {
+        ssize_t n = writev(fd, part, min<size_t>(count, IOV_MAX));
+
+        if (n < 0 && errno == EINTR)
+          continue;
+
+        if (n <= 0) {
+          rollback();
+          return false;
+        }
+
+        for (size_t done = n; done > 0;) {
+          size_t used = min(done, part->iov_len);
+          part->iov_base = static_cast<char *>(part->iov_base) + used;
+          part->iov_len -= used;
+          done -= used;
+
+          if (part->iov_len == 0)
+            ++part, --count;
+        }
+      }
+
+      if (fdatasync(fd) != 0) {
+        rollback();
+        return false;
+      }
+
+      size += frame.size() + length;
+
+      return true;
+    }
+
+    /*
+     * Read every intact record of a journal.
+     *
+     * => Truncates the journal after the last intact record, so later
+     * appends follow it directly.
+     *
+     * @param path The journal's filename.
+     * @return The records, in the order they were appended.
+     */
+    static vector<string> read(const string &path) {
+      ifstream stream(path, ios::binary);
+      vector<string> records;
+      uint64_t end = 0, size = filesystem::file_size(path);
+
+      for (;;) {
+        uint64_t length, checksum;
+
+        stream.read(reinterpret_cast<char *>(&length), sizeof(length));
+        stream.read(reinterpret_cast<char *>(&checksum), sizeof(checksum));
+
+        if (!stream || length > size - end)
+          break;
+
+        string record(length, '\0');
+        stream.read(&record[0], length);
+
+        if (!stream || xxh64(record) != checksum)
+          break;
+
+        records.push_back(record);
+        end += sizeof(length) + sizeof(checksum) + length;
+      }
+
+      stream.close();
+
+      if (end < size)
+        truncate(path.c_str(), end);
+
+      return records;
+    }
+
+    /*
+     * Journal destructor.
+     */
+    ~Journal() {
+      if (fd != -1)
+        close(fd);
+    }
+};
+
+/*
+ * Usage counters of a content cache.
+ */
+struct CacheStats {
+  size_t hits, misses, evictions, resident, budget;
+};
+
+/*
+ * A least recently used cache of decoded version contents, and of their
+ * line indexes once built, holding about `budget` bytes.
+ *
+ * Contents are handed out as shared pointers, so one that is evicted
+ * stays valid for as long as it is still being read.
+ */
+class ContentCache {
+  private:
+    struct Entry {
+      int version;
+      size_t size;
+      shared_ptr<const string> content;
+      shared_ptr<const LineIndex> lines;
+    };
+
+    list<Entry> entries;
+    unordered_map<int, list<Entry>::iterator> index;
+    CacheStats stats;
+
+    /*
+     * Evict the least recently used contents until the cache is within
+     * its budget, always keeping the most recently used one.
+     */
+    void trim() {
+      while (stats.resident > stats.budget && entries.size() > 1) {
+        Entry &entry = entries.back();
+        stats.resident -= entry.size;
+        index.erase(entry.version);
+        entries.pop_back();
+        ++stats.evictions;
+      }
+    }
+
+  public:
+    /*
+     * Default constructor.
+     *
+     * @param budget The number of bytes to keep.
+     */
+    ContentCache(size_t budget = CACHE_BUDGET) {
+      this->stats = CacheStats{0, 0, 0, 0, budget};
+    }
+
+    /*
+     * Look up a content, making it the most recently used.
+     *
+     * @param version The content's version.
+     * @return The content, or `nullptr` if it is not cached.
+     */
+    shared_ptr<const string> find(int version) {
+      auto it = index.find(version);
+
+      if (it == index.end()) {
+        ++stats.misses;
+        return nullptr;
+      }
+
+      ++stats.hits;
+      entries.splice(entries.begin(), entries, it->second);
+
+      return it->second->content;
+    }
+
+    /*
+     * Look up a content without counting or reordering.
+     *
+     * => Does not modify the cache, so it may run on several threads.
+     *
+     * @param version The content's version.
+     * @return The content, or `nullptr` if it is not cached.
+     */
+    const string *peek(int version) const {
+      auto it = index.find(version);
+      return it == index.end() ? nullptr : it->second->content.get();
+    }
+
+    /*
+     * Cache a content as the most recently used.
+     *
+     * @param version The content's version.
+     * @param content The content.
+     */
+    void put(int version, shared_ptr<const string> content) {
+      erase(version);
+
+      stats.resident += content->size();
+      entries.push_front(Entry{version, content->size(), move(content), {}});
+      index[version] = entries.begin();
+
+      trim();
+    }
+
+    /*
+     * Look up the line index of a cached content, without counting or
+     * reordering.
+     *
+     * @param version The content's version.
+     * @return The line index, or `nullptr` if it is not cached.
+     */
+    shared_ptr<const LineIndex> find_lines(int version) {
+      auto it = index.find(version);
+      return it == index.end() ? nullptr : it->second->lines;
+    }
+
+    /*
+     * Attach a line index to a cached content.
+     *
+     * => Does nothing if the content is not cached.
+     *
+     * @param version The content's version.
+     * @param lines The content's line index.
+     */
+    void put_lines(int version, shared_ptr<const LineIndex> lines) {
+      auto it = index.find(version);
+
+      if (it == index.end() || it->second->lines)
+        return;
+
+      it->second->size += lines->footprint();
+      stats.resident += lines->footprint();
+      it->second->lines = move(lines);
+
+      trim();
+    }
+
+    /*
+     * Drop a content from the cache.
+     *
+     * @param version The content's version.
+     */
+    void erase(int version) {
+      auto it = index.find(version);
+
+      if (it == index.end())
+        return;
+
+      stats.resident -= it->second->size;
+      entries.erase(it->second);
+      index.erase(it);
+    }
+
+    /*
+     * Set the number of bytes to keep, evicting contents if needed.
+     *
+     * @param budget The number of bytes.
+     */
+    void set_budget(size_t budget) {
+      stats.budget = budget;
+      trim();
+    }
+
+    /*
+     * Get the usage counters of this cache.
+     *
+     * @return The counters.
+     */
+    CacheStats get_stats() {
+      return stats;
+    }
+};
+
+/*
+ * A single file version.
+ *
+ * `prev` and `next` are the slots of the neighbouring versions in the
+ * owning list's ordering, or -1 at either end. The content is kept in
+ * the owning list's chunk store, as the ids of its chunks, and `hash` is
+ * the content's XXH64 hash. `stat` is the stat of the tracked file when
+ * it last held this content, if known.
+ */
+class Node {
+  public:
+    int prev, next;
+    int version;
+    ChunkIds chunks;
+    uint64_t hash;
+    FileStat stat;
+
+    Node(int version, ChunkIds chunks, uint64_t hash) {
+      this->prev = -1;
+      this->next = -1;
+      this->version = version;
+      this->chunks = chunks;
+      this->hash = hash;
+      this->stat = FileStat{};
+    }
+};
+
+/*
+ * A file version along with its decoded content.
+ */
+struct Version {
+  int version;
+  uint64_t hash;
+  string content;
+};
+
+/*
+ * Overloaded `<<` operator for a `Version` instance.
+ */
+ostream &operator<<(ostream &outs, const Version &version) {
+  return outs << "Version number: " << version.version << '\n'
+              << "Hash value: " << version.hash << '\n'
+              << "Content: " << version.content;
+}
+
+/*
+ * A fixed set of worker threads that share out one batch of indexed
+ * work at a time.
+ *
+ * The workers are started once and sleep between batches. Batches are
+ * run from a single thread, which takes part in each one.
+ */
+class WorkerPool {
+  private:
+    vector<thread> workers;
+    mutex lock;
+    condition_variable wake, done;
+    const function<void(size_t)> *work;
+    size_t count, busy;
+    atomic<size_t> next;
+    uint64_t batch;
+    bool stopping;
+
+    /*
+     * Run work items of the current batch until none are left.
+     */
+    void drain() {
+      for (size_t i; (i = next++) < count;)
+        (*work)(i);
+    }
+
+    /*
+     * The worker loop.
+     */
+    void loop() {
+      uint64_t seen = 0;
+
+      for (;;) {
+        {
+          unique_lock<mutex> guard(lock);
+          wake.wait(guard, [&] { return stopping || batch != seen; });
+
+          if (stopping)
+            return;
+
+          seen = batch;
+        }
+
+        drain();
+
+        lock_guard<mutex> guard(lock);
+
+        if (--busy == 0)
+          done.notify_one();
+      }
+    }
+
+  public:
+    /*
+     * Default constructor.
+     *
+     * @param threads The number of threads work runs on, counting the
+     * one running the batches.
+     */
+    WorkerPool(size_t threads = thread::hardware_concurrency()) {
+      this->work = nullptr;
+      this->count = 0;
+      this->busy = 0;
+      this->next = 0;
+      this->batch = 0;
+      this->stopping = false;
+
+      for (size_t i = 1; i < threads; ++i)
+        workers.emplace_back([this] { loop(); });
+    }
+
+    /*
+     * Run some work for each index below `count`, and wait for all of
+     * it to finish.
+     *
+     * @param count The number of work items.
+     * @param work The work for one index.
+     */
+    void run(size_t count, const function<void(size_t)> &work) {
+      {
+        lock_guard<mutex> guard(lock);
+        this->work = &work;
+        this->count = count;
+        this->next = 0;
+        this->busy = workers.size();
+        ++batch;
+      }
+
+      wake.notify_all();
+      drain();
+
+      unique_lock<mutex> guard(lock);
+      done.wait(guard, [&] { return busy == 0; });
+    }
+
+    /*
+     * WorkerPool destructor.
+     */
+    ~WorkerPool() {
+      {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+      }
+
+      wake.notify_all();
+
+      for (auto &worker : workers)
+        worker.join();
+    }
+};
+
+/*
+ * A list of file versions.
+ *
+ * Nodes live in a contiguous array of slots and are found through a
+ * version to slot map. The versions are ordered by when they were last
+ * made current, through intrusive links between slots, with the
+ * currently loaded version at the head.
+ *
+ * Version contents are kept in a chunk store shared by all versions, so
+ * storage grows with the bytes that change between versions. The
+ * contents of recently used versions are also kept decoded, in a cache
+ * with a memory budget.
+ */
+class List {
+  private:
+    vector<Node> nodes;
+    vector<int> free_slots;
+    unordered_map<int, int> slots;
+    ChunkStore store;
+    ContentCache cache;
+    TrigramIndex trigrams;
+    Journal *journal;
+    uint64_t generation;
+    MappedFile *mapping;
+    uint64_t mapped_generation;
+    bool atomic_checkout;
+    int head;
+    int version;
+    string filename;
+
+    /*
+     * Get the number of versions in this list.
+     *
+     * @return The length of the list.
+     */
+    int length() {
+      return slots.size();
+    }
+
+    /*
+     * Get a node with a specific version.
+     *
+     * @param version The version of the node.
+     * @return The node with the specified version.
+     */
+    Node *find(int version) {
+      auto it = slots.find(version);
+      return it == slots.end() ? nullptr : &nodes[it->second];
+    }
+
+    /*
+     * Get the slot a node is stored in.
+     *
+     * @param node A node of this list.
+     * @return The node's slot.
+     */
+    int slot_of(Node *node) {
+      return node - nodes.data();
+    }
+
+    /*
+     * Detach a node from the version ordering.
+     *
+     * @param slot The node's slot.
+     */
+    void unlink(int slot) {
+      Node &node = nodes[slot];
+
+      if (node.prev != -1)
+        nodes[node.prev].next = node.next;
+      else
+        head = node.next;
+
+      if (node.next != -1)
+        nodes[node.next].prev = node.prev;
+
+      node.prev = node.next = -1;
+    }
+
+    /*
+     * Make a detached node the currently loaded version.
+     *
+     * @param slot The node's slot.
+     */
+    void push_front(int slot) {
+      nodes[slot].next = head;
+
+      if (head != -1)
+        nodes[head].prev = slot;
+
+      head = slot;
+    }
+
+    /*
+     * Rebuild the content of a version, or copy it from the content
+     * cache, without adding it to the cache.
+     *
+     * => Does not modify the list, so it may run on several threads.
+     *
+     * @param slot The node's slot.
+     * @return The node's content.
+     */
+    string content(int slot) const {
+      const string *hit = cache.peek(nodes[slot].version);
+      return hit ? *hit : store.get(nodes[slot].chunks);
+    }
+
+    /*
+     * Get the content of a version through the content cache.
+     *
+     * @param slot The node's slot.
+     * @return The node's content.
+     */
+    shared_ptr<const string> cached(int slot) {
+      int version = nodes[slot].version;
+      shared_ptr<const string> content = cache.find(version);
+
+      if (!content) {
+        content = make_shared<const string>(store.get(nodes[slot].chunks));
+        cache.put(version, content);
+      }
+
+      return content;
+    }
+
+    /*
+     * Get the line index of a version through the content cache,
+     * building it on first use.
+     *
+     * @param slot The node's slot.
+     * @param content The node's content.
+     * @return The content's line index.
+     */
+    shared_ptr<const LineIndex> line_index(int slot, const string &content) {
+      int version = nodes[slot].version;
+      shared_ptr<const LineIndex> lines = cache.find_lines(version);
+
+      if (!lines) {
+        lines = make_shared<const LineIndex>(content);
+        cache.put_lines(version, lines);
+      }
+
+      return lines;
+    }
+
+    /*
+     * Run some work for each index below `count`, spread over one
+     * thread per core.
+     *
+     * => The threads are started on first use and kept for the rest of
+     * the program.
+     *
+     * @param count The number of work items.
+     * @param work The work for one index.
+     */
+    static void parallel_for(size_t count, const function<void(size_t)> &work) {
+      static WorkerPool pool;
+      pool.run(count, work);
+    }
+
+    /*
+     * Store a new node in a free slot and make it the currently loaded
+     * version.
+     *
+     * @param version The file's version.
+     * @param chunks The ids of the file's chunks.
+     * @param hash The hash of the file's content.
+     */
+    void insert(int version, const ChunkIds &chunks, uint64_t hash) {
+      int slot;
+
+      if (free_slots.empty()) {
+        slot = nodes.size();
+        nodes.emplace_back(version, chunks, hash);
+      } else {
+        slot = free_slots.back();
+        free_slots.pop_back();
+        nodes[slot] = Node(version, chunks, hash);
+      }
+
+      slots[version] = slot;
+
+      push_front(slot);
+    }
+
+    /*
+     * Add a version unless it matches the currently loaded one.
+     *
+     * => Contents are only compared when their hashes are equal. The
+     * journal record points into the content buffer for the bytes of
+     * fresh chunks, and the buffer is then moved into the content cache
+     * as the version's decoded content. While the journal is newer than
+     * the mapped database, a running compaction may leave out that
+     * database's unused chunks, so the bytes of the chunks found only
+     * there are journaled too.
+     *
+     * @param version The file's version.
+     * @param content The file's content.
+     * @param stat The stat of the file the content was read from.
+     * @return Whether or not the version was added.
+     */
+    bool add_version(int version, string content, FileStat stat) {
+      uint64_t hash = xxh64(content);
+
+      if (head != -1 && nodes[head].hash == hash && *cached(head) == content) {
+        set_stat(head, stat);
+        report_unchanged();
+        return false;
+      }
+
+      vector<char> fresh;
+      vector<uint64_t> chunks = store.put(content, &fresh);
+      bool stale = mapping != nullptr && mapped_generation != generation;
+
+      if (journal) {
+        string fields = "A";
+        put_value(fields, version);
+        put_value(fields, hash);
+        put_value(fields, chunks.size());
+
+        vector<pair<size_t, string_view>> slices;
+
+        for (size_t i = 0, pos = 0; i < chunks.size(); ++i) {
+          size_t size = store.length(chunks[i]);
+          char bytes = fresh[i] || (stale && !store.is_resident(chunks[i]));
+
+          put_value(fields, chunks[i]);
+          put_value(fields, bytes);
+
+          if (bytes) {
+            put_value(fields, size);
+            slices.push_back(
+              make_pair(fields.size(), string_view(content).substr(pos, size))
+            );
+          }
+
+          pos += size;
+        }
+
+        string_view header = fields;
+        vector<string_view> record;
+        size_t from = 0;
+
+        for (auto &slice : slices) {
+          record.push_back(header.substr(from, slice.first - from));
+          record.push_back(slice.second);
+          from = slice.first;
+        }
+
+        record.push_back(header.substr(from));
+
+        if (!journal->append(record)) {
+          store.release(chunks);
+          report_unsaved();
+          return false;
+        }
+      }
+
+      insert(version, ChunkIds(move(chunks)), hash);
+      trigrams.add(version, content);
+      set_stat(head, stat);
+      cache.put(version, make_shared<const string>(move(content)));
+
+      return true;
+    }
+
+    /*
+     * Tell the user that the tracked file has not changed.
+     */
+    static void report_unchanged() {
+      cout << "git322 did not detect any change to your file and will not "
+              "create a new version."
+           << "\n";
+    }
+
+    /*
+     * Tell the user that a change could not be saved to the journal.
+     */
+    static void report_unsaved() {
+      cout << "git322 could not save this change to disk, so it was not "
+              "made."
+           << '\n';
+    }
+
+    /*
+     * Record the stat of the file a version's content is in.
+     *
+     * => A stat too recent to be trusted is recorded as unknown, and so
+     * is a stat that cannot be saved to the journal.
+     *
+     * @param slot The node's slot.
+     * @param stat The file's stat.
+     */
+    void set_stat(int slot, FileStat stat) {
+      Node &node = nodes[slot];
+
+      if (!is_settled(stat))
+        stat = FileStat{};
+
+      if (!memcmp(&node.stat, &stat, sizeof(stat)))
+        return;
+
+      node.stat = stat;
+
+      if (journal) {
+        string record = "S";
+        put_value(record, node.version);
+        put_value(record, stat);
+
+        if (!journal->append(record))
+          node.stat = FileStat{};
+      }
+    }
+
+    /*
+     * Record a change that only names a version, before it is made.
+     *
+     * => Tells the user when the record cannot be saved, in which case
+     * the change must not be made.
+     *
+     * @param type The record type, 'R' (remove) or 'L' (load).
+     * @param version The version.
+     * @return Whether or not the record was saved.
+     */
+    bool record(char type, int version) {
+      if (!journal)
+        return true;
+
+      string record(1, type);
+      put_value(record, version);
+
+      if (journal->append(record))
+        return true;
+
+      report_unsaved();
+      return false;
+    }
+
+    /*
+     * Remove a node.
+     *
+     * @param slot The node's slot.
+     */
+    void drop(int slot) {
+      Node &node = nodes[slot];
+
+      trigrams.remove(node.version, content(slot));
+      unlink(slot);
+      slots.erase(node.version);
+      store.release(node.chunks);
+      cache.erase(node.version);
+      node.chunks = ChunkIds();
+      free_slots.push_back(slot);
+    }
+
+    /*
+     * Bring the tracked file in line with a content by rewriting only
+     * the blocks that differ, then cutting it to length.
+     *
+     * => Keeps the file's inode, but a crash may leave it partly
+     * updated.
+     *
+     * @param content The content.
+     * @return Whether or not the file was updated.
+     */
+    bool patch_file(const string &content) {
+      int fd = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+
+      if (fd == -1)
+        return false;
+
+      struct stat info;
+      size_t size = fstat(fd, &info) == 0 ? info.st_size : 0;
+      string window(CHECKOUT_WINDOW, '\0');
+      bool ok = true;
+
+      for (size_t pos = 0; ok && pos < content.size(); pos += window.size()) {
+        size_t length = min(window.size(), content.size() - pos);
+        size_t have =
+          pos < size ? pread_all(fd, &window[0], min(length, size - pos), pos)
+                     : 0;
+
+        auto differs = [&](size_t at) {
+          size_t block = min(CHECKOUT_BLOCK, length - at);
+          return at + block > have ||
+                 memcmp(&window[at], &content[pos + at], block) != 0;
+        };
+
+        for (size_t at = 0; ok && at < length;) {
+          size_t end = at;
+
+          while (end < length && differs(end))
+            end = min(end + CHECKOUT_BLOCK, length);
+
+          if (end > at)
+            ok = pwrite_all(fd, &content[pos + at], end - at, pos + at);
+          else
+            end = min(at + CHECKOUT_BLOCK, length);
+
+          at = end;
+        }
+      }
+
+      if (ok && size != content.size())
+        ok = ftruncate(fd, content.size()) == 0;
+
+      close(fd);
+
+      return ok;
+    }
+
+    /*
+     * Replace the tracked file with a content, through a temporary file
+     * that is renamed over it.
+     *
+     * => A crash leaves either the old or the new file in place.
+     *
+     * @param content The content.
+     * @return Whether or not the file was replaced.
+     */
+    bool replace_file(const string &content) {
+      string temp = filename + ".tmp";
+      int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+      if (fd == -1)
+        return false;
+
+      struct stat info;
+
+      if (stat(filename.c_str(), &info) == 0)
+        fchmod(fd, info.st_mode & 07777);
+
+      bool ok =
+        pwrite_all(fd, content.data(), content.size(), 0) && fsync(fd) == 0;
+
+      close(fd);
+
+      if (!ok || rename(temp.c_str(), filename.c_str()) != 0) {
+        ::unlink(temp.c_str());
+        return false;
+      }
+
+      sync_parent(filename);
+
+      return true;
+    }
+
+    /*
+     * Write the content of the currently loaded version to the tracked
+     * file.
+     *
+     * => Only rewrites the blocks of the file that changed, unless
+     * atomic checkouts are on. A file that was just written has no
+     * settled stat yet, so its version's stat is cleared, and the next
+     * add reads the file.
+     */
+    void checkout() {
+      shared_ptr<const string> content = cached(head);
+
+      if (atomic_checkout)
+        replace_file(*content);
+      else
+        patch_file(*content);
+
+      set_stat(head, get_file_stat(filename));
+    }
+
+    /*
+     * Read the tables of a mapped database into a list.
+     *
+     * => Only the table bounds are checked. Versions view their chunk
+     * ids in the mapping, chunk entries are found in the chunk table
+     * when a version is first read, and the search index is parsed when
+     * it is first used. Stops the program if a table does not fit in the
+     * file.
+     *
+     * @param data The list, which takes ownership of the mapping.
+     * @param mapping The mapped database.
+     * @param header The database's header.
+     */
+    static void read_mapped(
+      List *data, MappedFile *mapping, const DatabaseHeader &header
+    ) {
+      const char *base = mapping->data;
+      size_t size = mapping->size;
+
+      data->mapping = mapping;
+      data->generation = header.generation;
+      data->mapped_generation = header.generation;
+
+      auto fits = [&](uint64_t offset, uint64_t count, uint64_t width) {
+        return offset <= size && count <= (size - offset) / width;
+      };
+
+      if (!fits(header.chunk_table, header.chunk_count, sizeof(ChunkEntry)) ||
+          !fits(
+            header.version_table, header.version_count, sizeof(VersionEntry)
+          ) ||
+          !fits(header.index_offset, header.index_size, 1))
+        fail("The database tables do not fit in the file");
+
+      data->store.attach(ChunkTable{
+        base, size, base + header.chunk_table, header.chunk_count
+      });
+
+      int curr_version = 0;
+
+      for (uint64_t i = header.version_count; i-- > 0;) {
+        VersionEntry entry;
+        memcpy(
+          &entry, base + header.version_table + i * sizeof(entry), sizeof(entry)
+        );
+
+        if (!fits(entry.offset, entry.length, sizeof(uint64_t)))
+          fail("A version table entry is out of range");
+
+        data->insert(
+          entry.version, ChunkIds(base + entry.offset, entry.length),
+          entry.hash
+        );
+        data->nodes[data->head].stat = entry.stat;
+
+        curr_version = max(entry.version, curr_version);
+      }
+
+      data->trigrams.attach(
+        string_view(base + header.index_offset, header.index_size)
+      );
+
+      data->set_version(curr_version + 1);
+    }
+
+    /*
+     * Read a format 0 database into a list.
+     *
+     * => These hold the number of versions, then each version's number,
+     * size and content, from the currently loaded version to the
+     * oldest. Stops the program if the database is cut short.
+     *
+     * @param data The list.
+     * @param stream The database.
+     */
+    static void read_legacy(List *data, istream &stream) {
+      stream.seekg(0, ios::end);
+      uint64_t left = stream.tellg();
+      stream.seekg(0);
+
+      int list_length = 0;
+      stream.read(reinterpret_cast<char *>(&list_length), sizeof(list_length));
+
+      vector<pair<int, string>> records;
+
+      for (int i = 0; i < list_length; ++i) {
+        int version;
+        size_t size;
+
+        stream.read(reinterpret_cast<char *>(&version), sizeof(version));
+        stream.read(reinterpret_cast<char *>(&size), sizeof(size));
+
+        if (!stream || size > left - uint64_t(stream.tellg()))
+          fail("The database is cut short");
+
+        string content(size, '\0');
+        stream.read(&content[0], size);
+
+        records.emplace_back(version, move(content));
+      }
+
+      int curr_version = 0;
+
+      for (auto it = records.rbegin(); it != records.rend(); ++it) {
+        data->add(it->first, move(it->second));
+        curr_version = max(it->first, curr_version);
+      }
+
+      data->set_version(curr_version + 1);
+    }
+
+  public:
+    /*
+     * Default constructor.
+     */
+    List(string filename) {
+      this->filename = filename;
+      this->journal = nullptr;
+      this->generation = 0;
+      this->mapping = nullptr;
+      this->mapped_generation = 0;
+      this->atomic_checkout = false;
+      this->head = -1;
+      this->version = 1;
+    }
+
+    /*
+     * List destructor.
+     */
+    ~List() {
+      delete mapping;
+    }
+
+    /*
+     * Get the tracked filename from this list.
+     *
+     * @return The tracked filename.
+     */
+    string get_filename() {
+      return filename;
+    }
+
+    /*
+     * Set the current version of this list.
+     *
+     * @param version The current version of this list.
+     */
+    void set_version(int version) {
+      this->version = version;
+    }
+
+    /*
+     * Set the journal that records changes to this list.
+     *
+     * @param journal The journal, or `nullptr` to stop recording.
+     */
+    void set_journal(Journal *journal) {
+      this->journal = journal;
+    }
+
+    /*
+     * Get the generation of the first journal not included in this
+     * list's database.
+     *
+     * @return The journal generation.
+     */
+    uint64_t get_generation() {
+      return generation;
+    }
+
+    /*
+     * Set the generation of the first journal not included in this
+     * list's database.
+     *
+     * @param generation The journal generation.
+     */
+    void set_generation(uint64_t generation) {
+      this->generation = generation;
+    }
+
+    /*
+     * Set the number of bytes of decoded contents this list keeps in
+     * memory.
+     *
+     * @param budget The number of bytes.
+     */
+    void set_cache_budget(size_t budget) {
+      cache.set_budget(budget);
+    }
+
+    /*
+     * Choose how the tracked file is updated when the currently loaded
+     * version changes.
+     *
+     * @param atomic Whether to replace the file through a temporary file
+     * and a rename, rather than rewrite only its changed blocks in place.
+     */
+    void set_atomic_checkout(bool atomic) {
+      this->atomic_checkout = atomic;
+    }
+
+    /*
+     * Get the usage counters of this list's content cache.
+     *
+     * @return The counters.
+     */
+    CacheStats get_cache_stats() {
+      return cache.get_stats();
+    }
+
+    /*
+     * Print the usage counters of this list's content cache.
+     */
+    void print_cache() {
+      CacheStats stats = cache.get_stats();
+      size_t lookups = stats.hits + stats.misses;
+
+      cout << "Cache hits: " << stats.hits << " of " << lookups << '\n'
+           << "Cache evictions: " << stats.evictions << '\n'
+           << "Cache resident bytes: " << stats.resident << " of "
+           << stats.budget << '\n';
+    }
+
+    /*
+     * Move this list's chunks onto a newly written database.
+     *
+     * => Versions the database holds view their chunk ids in it, and
+     * the resident copies of the chunks it holds are freed, their bytes
+     * being read back from the mapped database when needed. Versions
+     * added since it was written keep their chunks resident. Does
+     * nothing if the database's tables do not fit in the file.
+     *
+     * @param db The database filename.
+     */
+    void remap(const string &db) {
+      MappedFile *next = new MappedFile(db);
+      const char *base = next->data;
+      size_t size = next->size;
+
+      auto fits = [&](uint64_t offset, uint64_t count, uint64_t width) {
+        return offset <= size && count <= (size - offset) / width;
+      };
+
+      DatabaseHeader header{};
+
+      if (size >= sizeof(header))
+        memcpy(&header, base, sizeof(header));
 
-      Node *curr = head;
+      bool valid =
+        !memcmp(header.magic, DB_MAGIC, sizeof(header.magic)) &&
+        header.format == DB_FORMAT &&
+        fits(header.chunk_table, header.chunk_count, sizeof(ChunkEntry)) &&
+        fits(header.version_table, header.version_count, sizeof(VersionEntry));
 
-      while (curr != nullptr) {
-        ++ans;
-        curr = curr->next;
+      unordered_map<int, VersionEntry> entries;
+
+      for (uint64_t i = 0; valid && i < header.version_count; ++i) {
+        VersionEntry entry;
+        memcpy(
+          &entry, base + header.version_table + i * sizeof(entry), sizeof(entry)
+        );
+
+        valid = fits(entry.offset, entry.length, sizeof(uint64_t));
+        entries[entry.version] = entry;
       }
 
-      return ans;
-    }
+      if (!valid) {
+        delete next;
+        return;
+      }
 
-    /*
-     * Get a node with a specific version.
-     *
-     * @param version The version of the node.
-     * @return The node with the specified version.
-     */
-    Node *find(int version) {
-      Node *curr = head;
+      vector<const ChunkIds *> kept;
+
+      for (int slot = head; slot != -1; slot = nodes[slot].next) {
+        Node &node = nodes[slot];
+        auto it = entries.find(node.version);
+
+        if (it != entries.end() && it->second.hash == node.hash) {
+          node.chunks = ChunkIds(base + it->second.offset, it->second.length);
+          continue;
+        }
+
+        if (mapping != nullptr &&
+            node.chunks.is_in(mapping->data, mapping->size))
+          node.chunks = ChunkIds(node.chunks.copy());
 
-      while (curr != nullptr) {
-        if (curr->version == version)
-          return curr;
-        curr = curr->next;
+        kept.push_back(&node.chunks);
       }
 
-      return nullptr;
-    }
+      store.remap(
+        ChunkTable{base, size, base + header.chunk_table, header.chunk_count},
+        kept
+      );
 
-  public:
-    /*
-     * Default constructor.
-     */
-    List(string filename) {
-      this->filename = filename;
-      this->head = nullptr;
-      this->version = 1;
-    }
+      if (mapping != nullptr) {
+        trigrams.ensure();
+        delete mapping;
+      }
 
-    /*
-     * Get the tracked filename from this list.
-     *
-     * @return The tracked filename.
-     */
-    string get_filename() {
-      return filename;
+      mapping = next;
+      mapped_generation = header.generation;
     }
 
     /*
-     * Set the current version of this list.
+     * Add a new file version to the list.
      *
-     * @param version The current version of this list.
+     * => Adds a new node to the front of the list.
+     *
+     * @param content The file's content.
      */
-    void set_version(int version) {
-      this->version = version;
+    void add(string content) {
+      if (add_version(version, move(content), FileStat{}))
+        ++version;
     }
 
     /*
      * Add a new file version to the list.
      *
-     * => Adds a new node to the front of the linked list.
+     * => Adds a new node to the front of the list, and records the stat
+     * of the file the content was read from.
      *
      * @param content The file's content.
+     * @param stat The file's stat.
      */
-    void add(string content) {
-      Node *curr = head;
-
-      if (curr == nullptr) {
-        head = new Node(version++, content, nullptr);
-        return;
-      }
-
-      if (head->content == content) {
-        cout << "git322 did not detect any change to your file and will not "
-                "create a new version."
-             << "\n";
-        return;
-      }
+    void add(string content, const FileStat &stat) {
+      if (add_version(version, move(content), stat))
+        ++version;
+    }
 
-      curr = new Node(version++, content, head);
+    /*
+     * Skip adding the tracked file if its stat matches the one recorded
+     * for the currently loaded version, without reading it.
+     *
+     * @param stat The tracked file's stat.
+     * @return Whether or not the add was skipped.
+     */
+    bool skip_add(const FileStat &stat) {
+      if (head == -1 || !same_stat(nodes[head].stat, stat))
+        return false;
 
-      head = curr;
+      report_unchanged();
+      return true;
     }
 
     /*
      * Add a new file version to the list.
      *
-     * => Adds a new node to the front of the linked list.
+     * => Adds a new node to the front of the list.
      *
      * @param version The file's version.
      * @param content The file's content.
      */
     void add(int version, string content) {
-      Node *curr = head;
-
-      if (curr == nullptr) {
-        head = new Node(version, content, nullptr);
-        return;
-      }
-
-      if (head->content == content) {
-        cout << "git322 did not detect any change to your file and will not "
-                "create a new version."
-             << "\n";
-        return;
-      }
-
-      curr = new Node(version, content, head);
-
-      head = curr;
+      add_version(version, move(content), FileStat{});
     }
 
     /*
      * Print list information
      */
     void print() {
-      Node *curr = head;
-
       cout << "Number of versions: " << length() << '\n';
 
-      if (curr == nullptr)
-        return;
-
-      while (curr != nullptr) {
-        cout << curr << '\n';
-        curr = curr->next;
-      }
+      for (int slot = head; slot != -1; slot = nodes[slot].next)
+        cout << Version{nodes[slot].version, nodes[slot].hash, content(slot)}
+             << '\n';
     }
 
     /*
@@ -212,37 +3337,34 @@ class List {
         return;
       }
 
-      if (curr == head) {
+      int slot = slot_of(curr);
+
+      if (slot == head) {
         cout << "Version " << version
              << " is already the currently loaded version." << '\n';
         return;
       }
 
-      if (curr != head) {
-        Node *temp = head;
-
-        while (temp->next != curr)
-          temp = temp->next;
-
-        temp->next = curr->next;
-        curr->next = head;
-        head = curr;
+      if (!record('L', version))
+        return;
 
-        ofstream file;
-        file.open(filename);
-        file << head->content;
-        file.close();
+      unlink(slot);
+      push_front(slot);
+      checkout();
 
-        cout << "Version " << version
-             << " loaded successfully. Please refresh your text editor to see "
-                "the changes."
-             << '\n';
-      }
+      cout << "Version " << version
+           << " loaded successfully. Please refresh your text editor to see "
+              "the changes."
+           << '\n';
     }
 
     /*
      * Compare the contents of two file versions.
      *
+     * => Lines are paired up along a longest common subsequence of the
+     * two versions' lines, so an inserted or deleted line does not shift
+     * every line after it.
+     *
      * @param version1 The left version.
      * @param version2 The right version.
      */
@@ -263,72 +3385,133 @@ class List {
         return;
       }
 
-      auto get_lines = [&](string s) {
-        istringstream stream(s);
-        string line;
-        vector<string> result;
-        while (getline(stream, line))
-          result.push_back(line);
-        return result;
+      auto transform = [&](string_view s) {
+        return s.empty() ? string_view("<Empty line>") : s;
       };
 
-      auto transform = [&](string s) { return s.empty() ? "<Empty line>" : s; };
+      int slot1 = slot_of(left), slot2 = slot_of(right);
 
-      vector<string> lines1 = get_lines(left->content),
-                     lines2 = get_lines(right->content);
+      shared_ptr<const string> text1 = cached(slot1), text2 = cached(slot2);
+      shared_ptr<const LineIndex> lines1 = line_index(slot1, *text1),
+                                  lines2 = line_index(slot2, *text2);
 
-      int i = 0;
+      vector<pair<size_t, size_t>> matches =
+        LineDiff(*text1, *lines1, *text2, *lines2).get_matches();
+      matches.emplace_back(lines1->count(), lines2->count());
 
-      for (;;) {
-        if (i >= lines1.size() && i >= lines2.size())
-          break;
+      size_t i = 0, j = 0;
+      int row = 0;
 
-        cout << "Line " << (i + 1) << ": ";
+      for (auto &match : matches) {
+        while (i < match.first || j < match.second) {
+          cout << "Line " << ++row << ": ";
 
-        if (i < lines1.size() && i < lines2.size()) {
-          if (lines1[i] != lines2[i])
-            cout << transform(lines1[i]) << " <<>> " << transform(lines2[i]);
+          if (i < match.first && j < match.second)
+            cout << transform(lines1->line(*text1, i++)) << " <<>> "
+                 << transform(lines2->line(*text2, j++));
+          else if (i < match.first)
+            cout << lines1->line(*text1, i++) << " <<>> "
+                 << "<Empty line>";
           else
-            cout << "<Identical>";
-        } else if (i >= lines1.size() && i < lines2.size())
-          cout << "<Empty line>"
-               << " <<>> " << lines2[i];
-        else
-          cout << lines1[i] << " <<>> "
-               << "<Empty line>";
+            cout << "<Empty line>"
+                 << " <<>> " << lines2->line(*text2, j++);
 
-        cout << '\n';
+          cout << '\n';
+        }
 
-        ++i;
+        if (i < lines1->count() && j < lines2->count()) {
+          cout << "Line " << ++row << ": <Identical>" << '\n';
+          ++i, ++j;
+        }
       }
     }
 
     /*
      * Search for file versions containing `keyword`.
      *
+     * => Only versions containing every trigram of `keyword` are
+     * scanned. Versions are scanned in parallel, one at a time per
+     * thread. Contents are not kept after the scan; the matching ones
+     * are decoded again one at a time as they are printed.
+     *
      * @param keyword The keyword to look for.
      */
     void search(string keyword) {
-      Node *curr = head;
+      vector<int> candidates, order;
 
-      vector<Node *> nodes;
+      bool indexed = trigrams.candidates(keyword, candidates);
 
-      while (curr != nullptr) {
-        if (curr->contains(keyword))
-          nodes.push_back(curr);
-        curr = curr->next;
+      for (int slot = head; slot != -1; slot = nodes[slot].next) {
+        int version = nodes[slot].version;
+        if (!indexed ||
+            binary_search(candidates.begin(), candidates.end(), version))
+          order.push_back(slot);
       }
 
-      if (!nodes.empty()) {
+      vector<char> matched(order.size());
+
+      parallel_for(order.size(), [&](size_t i) {
+        matched[i] = contains(content(order[i]), keyword);
+      });
+
+      if (count(matched.begin(), matched.end(), 1) > 0) {
         cout << "The keyword " << keyword
              << " has been found in the following versions:" << '\n';
-        for (auto node : nodes)
-          cout << node << '\n';
+        for (size_t i = 0; i < order.size(); ++i) {
+          Node &node = nodes[order[i]];
+          if (matched[i])
+            cout << Version{node.version, node.hash, content(order[i])} << '\n';
+        }
       } else
         cout << "Your keyword '" << keyword << "' was not found in any version."
              << '\n';
     }
 
+    /*
+     * Search for file versions containing each of several keywords.
+     *
+     * => Scans every version once, matching all of the keywords at the
+     * same time.
+     *
+     * @param keywords The keywords to look for.
+     */
+    void search_all(const vector<string> &keywords) {
+      KeywordMatcher matcher(keywords);
+
+      vector<int> order;
+
+      for (int slot = head; slot != -1; slot = nodes[slot].next)
+        order.push_back(slot);
+
+      vector<vector<char>> found(order.size());
+
+      parallel_for(order.size(), [&](size_t i) {
+        found[i] = matcher.match(content(order[i]));
+      });
+
+      for (size_t k = 0; k < keywords.size(); ++k) {
+        vector<int> versions;
+
+        for (size_t i = 0; i < order.size(); ++i)
+          if (found[i][k])
+            versions.push_back(nodes[order[i]].version);
+
+        if (versions.empty()) {
+          cout << "Your keyword '" << keywords[k]
+               << "' was not found in any version." << '\n';
+          continue;
+        }
+
+        cout << "The keyword " << keywords[k]
+             << " has been found in the following versions:";
+
+        for (int version : versions)
+          cout << ' ' << version;
+
+        cout << '\n';
+      }
+    }
+
     /*
      * Remove a file version from the list.
      *
@@ -342,119 +3525,187 @@ class List {
         return;
       }
 
-      bool was_active = curr == head;
+      if (!record('R', version))
+        return;
 
-      if (was_active) {
-        head = head->next;
-      } else {
-        Node *temp = head;
-        while (temp->next != curr)
-          temp = temp->next;
-        temp->next = curr->next;
-      }
+      int slot = slot_of(curr);
 
-      if (was_active && head != nullptr) {
-        ofstream file;
-        file.open(filename);
-        file << head->content;
-        file.close();
-      }
+      bool was_active = slot == head;
 
-      delete curr;
+      drop(slot);
+
+      if (was_active && head != -1)
+        checkout();
 
       cout << "Version " << version << " deleted successfully." << '\n';
     }
 
     /*
-     * Serialize this list to disk.
+     * Apply records from a journal, as if the commands that wrote them
+     * had run again, without output and without touching the tracked
+     * file.
      *
-     * @param filename The filename we should serialize data to.
+     * @param records The records, in the order they were appended.
      */
-    void serialize(const string &db) {
-      ofstream stream(db, ios::binary);
+    void replay(const vector<string> &records) {
+      for (const string &record : records) {
+        size_t pos = 1;
+        int version = get_value<int>(record, pos);
+        Node *curr = find(version);
 
-      int list_length = length();
-      stream.write(reinterpret_cast<char *>(&list_length), sizeof(list_length));
+        if (record[0] == 'R' && curr != nullptr)
+          drop(slot_of(curr));
 
-      Node *curr = head;
+        if (record[0] == 'L' && curr != nullptr) {
+          unlink(slot_of(curr));
+          push_front(slot_of(curr));
+        }
 
-      while (curr != nullptr) {
-        stream.write(
-          reinterpret_cast<char *>(&curr->version), sizeof(curr->version)
-        );
+        if (record[0] == 'S' && curr != nullptr)
+          curr->stat = get_value<FileStat>(record, pos);
 
-        size_t content_size = curr->content.size();
+        if (record[0] != 'A' || curr != nullptr)
+          continue;
 
-        stream.write(
-          reinterpret_cast<char *>(&content_size), sizeof(content_size)
-        );
+        uint64_t hash = get_value<uint64_t>(record, pos);
+        vector<uint64_t> chunks(get_value<size_t>(record, pos));
+
+        for (auto &id : chunks) {
+          id = get_value<uint64_t>(record, pos);
 
-        stream.write(curr->content.c_str(), curr->content.size());
+          if (get_value<char>(record, pos)) {
+            size_t size = get_value<size_t>(record, pos);
+            store.restore(id, record.substr(pos, size));
+            pos += size;
+          }
+        }
 
-        curr = curr->next;
+        ChunkIds ids(move(chunks));
+        store.retain(ids);
+        insert(version, ids, hash);
+        trigrams.add(version, content(head));
       }
 
-      stream.close();
+      if (records.empty())
+        return;
+
+      int latest = 0;
+
+      for (auto &entry : slots)
+        latest = max(latest, entry.first);
+
+      version = latest + 1;
     }
 
     /*
-     * Deserialize this list from disk.
+     * Serialize this list to disk.
      *
-     * @param filename The filename we should read data from.
-     * @return The deserialized list data structure.
+     * => Writes a `DatabaseHeader`, the chunk table, the version table
+     * (from the currently loaded version to the oldest), each version's
+     * chunk ids, the stored chunk bytes and the search index.
+     *
+     * @param filename The filename we should serialize data to.
+     * @return Whether or not every byte was written.
      */
-    static List *deserialize(const string &db, const string &filename) {
-      ifstream stream(db, ios::binary);
+    bool serialize(const string &db) {
+      ofstream stream(db, ios::binary);
 
-      List *data = new List(filename);
+      DatabaseHeader header{};
+      memcpy(header.magic, DB_MAGIC, sizeof(header.magic));
+      header.format = DB_FORMAT;
+      header.generation = generation;
+      vector<uint64_t> ids;
 
-      if (!stream.is_open())
-        return data;
+      for (int slot = head; slot != -1; slot = nodes[slot].next)
+        for (size_t i = 0; i < nodes[slot].chunks.size(); ++i)
+          ids.push_back(nodes[slot].chunks[i]);
 
-      int list_length;
-      stream.read(reinterpret_cast<char *>(&list_length), sizeof(list_length));
+      sort(ids.begin(), ids.end());
+      ids.erase(unique(ids.begin(), ids.end()), ids.end());
 
-      vector<pair<int, string>> to_insert;
+      header.chunk_count = ids.size();
+      header.chunk_table = sizeof(header);
+      header.version_count = length();
+      header.version_table =
+        header.chunk_table + header.chunk_count * sizeof(ChunkEntry);
 
-      for (int i = 0; i < list_length; ++i) {
-        int version;
-        stream.read(reinterpret_cast<char *>(&version), sizeof(version));
+      uint64_t offset =
+        header.version_table + header.version_count * sizeof(VersionEntry);
 
-        size_t content_size;
+      vector<VersionEntry> versions;
 
-        stream.read(
-          reinterpret_cast<char *>(&content_size), sizeof(content_size)
-        );
+      for (int slot = head; slot != -1; slot = nodes[slot].next) {
+        Node &node = nodes[slot];
+        versions.push_back(VersionEntry{
+          node.version, 0, offset, node.chunks.size(), node.hash, node.stat
+        });
+        offset += node.chunks.size() * sizeof(uint64_t);
+      }
 
-        string content(content_size, '\0');
-        stream.read(&content[0], content_size);
+      vector<ChunkEntry> chunks;
 
-        to_insert.push_back(make_pair(version, content));
-      }
+      stream.seekp(offset);
+      store.save(stream, ids, chunks);
 
-      int curr_version = 0;
+      header.index_offset = stream.tellp();
+      trigrams.save(stream);
+      header.index_size = uint64_t(stream.tellp()) - header.index_offset;
 
-      for (int i = to_insert.size() - 1; ~i; --i) {
-        data->add(to_insert[i].first, to_insert[i].second);
-        curr_version = max(to_insert[i].first, curr_version);
-      }
+      stream.seekp(0);
+      stream.write(reinterpret_cast<char *>(&header), sizeof(header));
+      stream.write(
+        reinterpret_cast<char *>(chunks.data()),
+        chunks.size() * sizeof(ChunkEntry)
+      );
+      stream.write(
+        reinterpret_cast<char *>(versions.data()),
+        versions.size() * sizeof(VersionEntry)
+      );
 
-      data->set_version(curr_version + 1);
+      for (int slot = head; slot != -1; slot = nodes[slot].next) {
+        string_view bytes = nodes[slot].chunks.bytes();
+        stream.write(bytes.data(), bytes.size());
+      }
 
       stream.close();
 
-      return data;
+      return stream.good();
     }
 
     /*
-     * List destructor.
+     * Deserialize this list from disk.
+     *
+     * => Databases in the current format are memory mapped, and only
+     * their tables are read. Format 0 databases are still accepted.
+     *
+     * @param filename The filename we should read data from.
+     * @return The deserialized list data structure.
      */
-    ~List() {
-      while (head != nullptr) {
-        Node *curr = head;
-        head = head->next;
-        delete curr;
+    static List *deserialize(const string &db, const string &filename) {
+      List *data = new List(filename);
+      MappedFile *mapping = new MappedFile(db);
+
+      DatabaseHeader header{};
+
+      if (mapping->size >= sizeof(header))
+        memcpy(&header, mapping->data, sizeof(header));
+
+      if (!memcmp(header.magic, DB_MAGIC, sizeof(header.magic))) {
+        if (header.format != DB_FORMAT)
+          fail("The database format is not supported");
+
+        read_mapped(data, mapping, header);
+        return data;
       }
+
+      delete mapping;
+
+      ifstream stream(db, ios::binary);
+
+      if (stream.is_open())
+        read_legacy(data, stream);
+
+      return data;
     }
 };
 
@@ -489,18 +3740,79 @@ class Scanner {
       return input;
     }
 
+    /*
+     * Read a line of whitespace separated words from stdin.
+     *
+     * @param prompt A text prompt.
+     * @return The words on the line.
+     */
+    static vector<string> read_words(string prompt) {
+      cout << prompt;
+      string line, word;
+      getline(cin >> ws, line);
+      istringstream stream(line);
+      vector<string> words;
+      while (stream >> word)
+        words.push_back(word);
+      return words;
+    }
+
     /*
      * Read and return the contents of a
      * file.
      *
+     * => The buffer is sized from `fstat` and read into directly, so the
+     * returned string is the only copy of the contents.
+     *
      * @param filename The name of the file.
+     * @param stat If given, set to the file's stat before it was read
+     * (output).
      * @return The contents of the file.
      */
-    static string read_file(string filename) {
-      ifstream stream(filename);
-      stringstream buffer;
-      buffer << stream.rdbuf();
-      return buffer.str();
+    static string read_file(string filename, FileStat *stat = nullptr) {
+      string content;
+      int fd = open(filename.c_str(), O_RDONLY);
+
+      if (stat)
+        *stat = FileStat{};
+
+      if (fd == -1)
+        return content;
+
+      struct stat info;
+
+      if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode)) {
+        content.resize(info.st_size);
+        if (stat)
+          *stat = get_file_stat(info);
+      }
+
+      for (size_t done = 0;;) {
+        ssize_t n;
+
+        if (done < content.size())
+          n = read(fd, &content[done], content.size() - done);
+        else {
+          char more[4096];
+          n = read(fd, more, sizeof(more));
+          if (n > 0)
+            content.append(more, n);
+        }
+
+        if (n < 0 && errno == EINTR)
+          continue;
+
+        if (n <= 0) {
+          content.resize(done);
+          break;
+        }
+
+        done += n;
+      }
+
+      close(fd);
+
+      return content;
     }
 };
 
@@ -520,6 +3832,8 @@ class Git322 {
       "To print to the screen the detailed list of all versions press 'p'\n"
       "To compare any 2 versions press 'c'\n"
       "To search versions for a keyword press 's'\n"
+      "To search versions for several keywords at once press 'b'\n"
+      "To print content cache statistics press 'i'\n"
       "To exit press 'e'\n\n";
 
     /*
@@ -532,6 +3846,9 @@ class Git322 {
       {"COMPARE_RHS",
        "Please enter the number of the second version to compare: "},
       {"SEARCH", "Please enter the keyword that you are looking for: "},
+      {"BATCH",
+       "Please enter the keywords that you are looking for, separated by "
+       "spaces: "},
       {"REMOVE", "Enter the number of the version that you want to delete: "}};
 
     /*
@@ -572,11 +3889,18 @@ class Git322 {
      *
      * @param input A single byte of user input.
      */
-    void eval() {
+    virtual void eval() {
       switch (scanner->read_byte(MENU)) {
-      case 'a':
-        list->add(scanner->read_file(list->get_filename()));
+      case 'a': {
+        FileStat stat = get_file_stat(list->get_filename());
+
+        if (!list->skip_add(stat)) {
+          string content = scanner->read_file(list->get_filename(), &stat);
+          list->add(move(content), stat);
+        }
+
         break;
+      }
       case 'p':
         list->print();
         break;
@@ -592,6 +3916,12 @@ class Git322 {
       case 's':
         list->search(scanner->read_string(prompt["SEARCH"]));
         break;
+      case 'b':
+        list->search_all(scanner->read_words(prompt["BATCH"]));
+        break;
+      case 'i':
+        list->print_cache();
+        break;
       case 'r':
         list->remove(stoi(scanner->read_string(prompt["REMOVE"])));
         break;
@@ -616,6 +3946,12 @@ class Git322 {
 
 /*
  * A file-tracking API with on-disk persistence.
+ *
+ * Each change is appended to a journal as its command runs. On startup
+ * the database snapshot is read and the journals written since are
+ * replayed. A journal that grows past `JOURNAL_LIMIT` is compacted into
+ * a new snapshot by a child process, while commands keep going to the
+ * next journal.
  */
 class EnhancedGit322 : public Git322 {
   private:
@@ -624,34 +3960,198 @@ class EnhancedGit322 : public Git322 {
      */
     string db;
 
+    /*
+     * The journal in use and its generation.
+     */
+    Journal *journal;
+    uint64_t generation;
+
+    /*
+     * The running compaction process, or -1.
+     */
+    pid_t compaction;
+
+    /*
+     * Get the filename of a journal.
+     *
+     * @param generation The journal's generation.
+     * @return The journal's filename.
+     */
+    string journal_path(uint64_t generation) {
+      return db + ".journal." + to_string(generation);
+    }
+
+    /*
+     * Delete the journals older than a generation.
+     *
+     * @param generation The oldest journal generation to keep.
+     */
+    void remove_journals(uint64_t generation) {
+      while (generation-- > 0 && unlink(journal_path(generation).c_str()) == 0)
+        ;
+    }
+
+    /*
+     * Atomically replace the database with a snapshot of the list.
+     *
+     * => The database is only replaced once the whole snapshot is on
+     * disk. A failed snapshot is deleted and leaves the database as it
+     * was.
+     *
+     * @return Whether or not the snapshot was written.
+     */
+    bool snapshot() {
+      string temp = db + ".tmp";
+
+      if (!list->serialize(temp) || !sync_path(temp) ||
+          rename(temp.c_str(), db.c_str()) != 0) {
+        unlink(temp.c_str());
+        return false;
+      }
+
+      return sync_parent(db);
+    }
+
+    /*
+     * Wait for a running compaction. If it succeeded, delete the
+     * journals it made redundant and move the list onto the new
+     * database.
+     *
+     * @param block Whether or not to wait for it to finish.
+     */
+    void reap(bool block) {
+      int status;
+
+      if (compaction == -1 ||
+          waitpid(compaction, &status, block ? 0 : WNOHANG) <= 0)
+        return;
+
+      if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        remove_journals(list->get_generation());
+        list->remap(db);
+      }
+
+      compaction = -1;
+    }
+
+    /*
+     * Start compacting the journals into the database once the current
+     * journal is large enough.
+     *
+     * => Switches to a new journal, then forks a child that snapshots
+     * the list as it was before the switch.
+     */
+    void compact() {
+      reap(false);
+
+      if (compaction != -1 || journal->get_size() < JOURNAL_LIMIT)
+        return;
+
+      Journal *next = new Journal(journal_path(generation + 1));
+      list->set_journal(next);
+      delete journal;
+      journal = next;
+
+      list->set_generation(++generation);
+
+      cout.flush();
+
+      compaction = fork();
+
+      if (compaction == 0)
+        _exit(snapshot() ? 0 : 1);
+
+      if (compaction == -1 && snapshot())
+        remove_journals(generation);
+    }
+
   public:
     /*
      * EnhancedGit322 constructor.
      *
      * Reads database from disk and passes
      * the resulting list instance to the
-     * super class.
+     * super class, then replays the journals
+     * written since.
      *
+     * @param filename The tracked file's name.
      * @param db The database filename.
+     * @param cache_budget The number of bytes of decoded contents kept
+     * in memory.
+     * @param atomic_checkout Whether to replace the tracked file through
+     * a temporary file and a rename on checkout.
      */
-    EnhancedGit322(string filename, string db)
+    EnhancedGit322(
+      string filename, string db, size_t cache_budget = CACHE_BUDGET,
+      bool atomic_checkout = false
+    )
       : Git322(List::deserialize(db, filename)) {
       this->db = db;
+      this->compaction = -1;
+
+      list->set_cache_budget(cache_budget);
+      list->set_atomic_checkout(atomic_checkout);
+
+      uint64_t first = list->get_generation();
+
+      remove_journals(first);
+
+      vector<string> records;
+
+      for (generation = first;; ++generation) {
+        string path = journal_path(generation);
+
+        if (filesystem::exists(path)) {
+          vector<string> more = Journal::read(path);
+          records.insert(records.end(), more.begin(), more.end());
+        }
+
+        if (!filesystem::exists(journal_path(generation + 1)))
+          break;
+      }
+
+      list->replay(records);
+
+      this->journal = new Journal(journal_path(generation));
+      list->set_journal(journal);
+    }
+
+    /*
+     * Run a command, then compact the journal if needed.
+     */
+    void eval() override {
+      Git322::eval();
+      compact();
     }
 
     /*
      * EnhancedGit322 destructor.
+     *
+     * Every change is already in the journal, so nothing is written.
      */
     ~EnhancedGit322() {
-      list->serialize(db);
+      reap(true);
+      list->set_journal(nullptr);
+      delete journal;
     }
 };
 
 /*
  * Program entrypoint.
+ *
+ * The `GIT322_CACHE_BUDGET` environment variable overrides the number
+ * of bytes of decoded contents kept in memory. Setting
+ * `GIT322_ATOMIC_CHECKOUT` makes checkouts replace the tracked file
+ * instead of rewriting its changed blocks in place.
  */
 int main() {
-  EnhancedGit322 *git = new EnhancedGit322("file.txt", "db.txt");
+  const char *budget = getenv("GIT322_CACHE_BUDGET");
+
+  EnhancedGit322 *git = new EnhancedGit322(
+    "file.txt", "db.txt",
+    budget != nullptr ? strtoull(budget, nullptr, 10) : CACHE_BUDGET,
+    getenv("GIT322_ATOMIC_CHECKOUT") != nullptr
+  );
 
   for (;;)
     git->eval();